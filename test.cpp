@@ -1,337 +1,2446 @@
 #include "test.hpp"
 
+#include <atomic>
+#include <csignal>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <memory>
+#include <poll.h>
+#include <sched.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <cxxabi.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef TEST_COUNT_ALLOCS
+#include <new>
+#endif
 
 opts_t opts;
 char *progname;
 
-extern volatile void (*__start_testcases)(void);
-extern volatile void (*__stop_testcases)(void);
+extern test::testcase_t *__start_testcases;
+extern test::testcase_t *__stop_testcases;
+extern test::benchmark_t *__start_benchmarks __attribute__((weak));
+extern test::benchmark_t *__stop_benchmarks __attribute__((weak));
+
+#ifdef TEST_COUNT_ALLOCS
+namespace test {
+thread_local alloc_counters_t alloc_counters{};
+}
+
+// Every block carries a header in front of it with the epoch of the case that allocated it and its size
+struct alloc_header_t {
+  uint64_t epoch;
+  uint64_t size;
+};
+
+static_assert(sizeof(alloc_header_t) == __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the header keeps new's alignment");
+
+static size_t header_offset(size_t alignment) { return std::max(alignment, sizeof(alloc_header_t)); }
+
+static void *counted_alloc(size_t size, size_t alignment) {
+  size_t offset = header_offset(alignment);
+  size_t aligned_size = (size + offset + alignment - 1) & ~(alignment - 1);
+  char *block = static_cast<char *>((alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+                                        ? std::aligned_alloc(alignment, aligned_size)
+                                        : std::malloc(size + offset));
+  if (!block)
+    throw std::bad_alloc();
+
+  test::alloc_counters_t &counters = test::alloc_counters;
+  alloc_header_t *header = reinterpret_cast<alloc_header_t *>(block + offset) - 1;
+  header->epoch = counters.active ? counters.epoch : 0;
+  header->size = size;
+  if (counters.active) {
+    counters.allocations++;
+    counters.bytes += size;
+  }
+  return block + offset;
+}
+
+// Frees are matched by epoch rather than by active, a case's block released from an uncounted scope still balances
+static void counted_free(void *ptr, size_t alignment) {
+  if (!ptr)
+    return;
+
+  test::alloc_counters_t &counters = test::alloc_counters;
+  alloc_header_t *header = static_cast<alloc_header_t *>(ptr) - 1;
+  if (header->epoch && header->epoch == counters.epoch)
+    counters.freed_bytes += header->size;
+  std::free(static_cast<char *>(ptr) - header_offset(alignment));
+}
+
+// libstdc++ forwards the nothrow and the aligned sized forms to these
+void *operator new(size_t size) { return counted_alloc(size, 0); }
+void *operator new[](size_t size) { return counted_alloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return counted_alloc(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return counted_alloc(size, size_t(alignment)); }
+void operator delete(void *ptr) noexcept { counted_free(ptr, 0); }
+void operator delete[](void *ptr) noexcept { counted_free(ptr, 0); }
+void operator delete(void *ptr, size_t) noexcept { counted_free(ptr, 0); }
+void operator delete[](void *ptr, size_t) noexcept { counted_free(ptr, 0); }
+void operator delete(void *ptr, std::align_val_t alignment) noexcept { counted_free(ptr, size_t(alignment)); }
+void operator delete[](void *ptr, std::align_val_t alignment) noexcept { counted_free(ptr, size_t(alignment)); }
+#endif
 
 namespace test {
 std::mutex mtx;
-std::vector<test::test_info_t> test_results;
-std::map<std::string, std::map<std::string, std::vector<std::tuple<bool, std::string, std::string, std::string>>>>
-    report;
+report_t report;
+std::vector<benchmark_result_t> benchmark_results;
 uint64_t asserts_counter;
-bool stub_res;
-thread_local std::string ts_name = "", tc_name = "";
+thread_local case_id_t current_case = no_case;
+thread_local bool in_testcase = false;
+thread_local results_buffer_t *p_local_results = nullptr;
+std::atomic<uint64_t> running_cases{no_case};
+
+// Records of threads started by a testcase body, handed to the case's own buffer when it ends
+static std::vector<test_info_t> foreign_records;
+static std::atomic<uint64_t> foreign_count{0};
+static std::mutex foreign_mtx;
+
+// Set when a failed ASSERT terminates, any other terminate inside a testcase is an escaped exception
+static thread_local bool assert_terminated = false;
+
+arena_t::~arena_t() {
+  while (head) {
+    chunk_t *next = head->next;
+    munmap(head, head->size);
+    head = next;
+  }
+}
+
+void *arena_t::do_allocate(size_t size, size_t alignment) {
+  char *ptr = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(pos) + alignment - 1) & ~(alignment - 1));
+  if (!pos || ptr + size > end) {
+    size_t map_size = std::max(chunk_size, (sizeof(chunk_t) + size + alignment + 4095) & ~size_t(4095));
+    void *map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+      throw std::bad_alloc();
+
+    head = new (map) chunk_t{head, map_size};
+    pos = reinterpret_cast<char *>(head + 1);
+    end = reinterpret_cast<char *>(map) + map_size;
+    ptr = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(pos) + alignment - 1) & ~(alignment - 1));
+    chunks++;
+  }
+
+  pos = ptr + size;
+  allocations++;
+  bytes += size;
+  return ptr;
+}
+
+static std::vector<std::unique_ptr<results_buffer_t>> &results_buffers() {
+  static std::vector<std::unique_ptr<results_buffer_t>> buffers;
+  return buffers;
+}
+
+static constexpr size_t output_block_size = 64 << 10;
+static constexpr size_t output_flush_size = 1 << 20;
+static std::mutex output_mtx;
+
+results_buffer_t *register_local_results(void) {
+  std::lock_guard<std::mutex> lock(mtx);
+  results_buffers().push_back(std::make_unique<results_buffer_t>());
+  results_buffers().back()->output.reserve(output_block_size);
+  return results_buffers().back().get();
+}
+
+// Every runnable testcase, TEST_P and TYPED_TEST contribute one per instance instead of their own descriptor
+static std::vector<testcase_t *> testcases;
+static std::deque<testcase_t> testcase_instances;
+static std::deque<std::string> instance_names;
+
+static void expand_instances(testcase_t *tc) {
+  size_t count = tc->instances();
+  for (size_t i = 0; i < count; i++) {
+    instance_names.push_back(std::string(tc->tc_name) + "/" + std::to_string(i));
+    testcase_instances.push_back(*tc);
+    testcase_instances.back().tc_name = instance_names.back().c_str();
+    testcase_instances.back().instance = i;
+    testcases.push_back(&testcase_instances.back());
+  }
+}
+
+void register_testcases(void) {
+  struct registration_t {
+    const char *ts_name;
+    const char *tc_name;
+    const char *base_name;
+    uint32_t instance;
+    case_id_t *id;
+  };
+
+  if (!report.cases.empty())
+    return;
+
+  std::vector<registration_t> registrations;
+  for (testcase_t **p = &__start_testcases; p < &__stop_testcases; p++) {
+    size_t first = testcases.size();
+    if ((*p)->instances)
+      expand_instances(*p);
+    else
+      testcases.push_back(*p);
+    for (size_t i = first; i < testcases.size(); i++)
+      registrations.push_back(registration_t{(*p)->ts_name, testcases[i]->tc_name, (*p)->tc_name,
+                                             testcases[i]->instance, &testcases[i]->id});
+  }
+  for (benchmark_t **p = &__start_benchmarks; p < &__stop_benchmarks; p++)
+    registrations.push_back(registration_t{(*p)->ts_name, (*p)->bm_name, (*p)->bm_name, 0, &(*p)->id});
+
+  // Instances sort by number under their base name, Case/2 before Case/10
+  std::sort(registrations.begin(), registrations.end(), [](const registration_t &a, const registration_t &b) {
+    int cmp = std::strcmp(a.ts_name, b.ts_name);
+    cmp = cmp ? cmp : std::strcmp(a.base_name, b.base_name);
+    return cmp ? cmp < 0 : a.instance < b.instance;
+  });
+
+  // Equal suite names are adjacent after sorting, every suite name is interned once
+  for (const registration_t &registration : registrations) {
+    if (report.suites.empty() || std::strcmp(report.suites.back(), registration.ts_name))
+      report.suites.push_back(registration.ts_name);
+    *registration.id = report.cases.size();
+    report.cases.push_back(case_info_t{report.suites.back(), registration.tc_name, uint32_t(report.suites.size() - 1)});
+  }
+
+  report.testcases.resize(report.cases.size());
+}
+
+void merge_results(void) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto add_checks = [](auto begin, auto end) -> void {
+    for (auto check_info = begin; check_info != end; ++check_info) {
+      testcase_report_t &tc_report =
+          (check_info->case_id != no_case) ? report.testcases[check_info->case_id] : report.outside;
+      (check_info->ok) ? tc_report.passed++ : tc_report.failed++;
+    }
+    report.checks.insert(report.checks.end(), begin, end);
+  };
+  for (std::unique_ptr<results_buffer_t> &results : results_buffers()) {
+    for (const testcase_entry_t &entry : results->testcases) {
+      testcase_report_t &tc_report = report.testcases[entry.case_id];
+      tc_report.fast_passes += entry.fast_passes;
+      tc_report.passed += entry.fast_passes;
+      tc_report.wall_ns += entry.wall_ns;
+      tc_report.cpu_ns += entry.cpu_ns;
+      tc_report.allocations += entry.allocations;
+      tc_report.alloc_bytes += entry.alloc_bytes;
+      tc_report.outstanding_bytes += entry.outstanding_bytes;
+      for (int i = 0; i < perf_events_num; i++)
+        tc_report.perf[i] += entry.perf[i];
+      tc_report.ran = true;
+    }
+    add_checks(results->test_results.begin(), results->test_results.end());
+    asserts_counter += results->asserts_counter + results->fast_passes;
+    results->test_results.clear();
+    results->testcases.clear();
+    results->asserts_counter = results->fast_passes = results->fast_passes_mark = results->records_mark = 0;
+  }
+
+  // Left by threads that outlived the case they checked for
+  {
+    std::lock_guard<std::mutex> foreign_lock(foreign_mtx);
+    add_checks(foreign_records.begin(), foreign_records.end());
+    foreign_records.clear();
+    foreign_count.store(0, std::memory_order_relaxed);
+  }
+
+  // Counting sort by case ID, records keep their order within a case and checks outside of testcases go last
+  std::vector<uint64_t> &begin = report.checks_begin;
+  begin.assign(report.cases.size() + 3, 0);
+  for (const test_info_t &check_info : report.checks)
+    begin[std::min<uint64_t>(check_info.case_id, report.cases.size()) + 2]++;
+  for (size_t i = 2; i < begin.size(); i++)
+    begin[i] += begin[i - 1];
+
+  std::vector<test_info_t> checks(report.checks.size());
+  for (const test_info_t &check_info : report.checks)
+    checks[begin[std::min<uint64_t>(check_info.case_id, report.cases.size()) + 1]++] = check_info;
+  report.checks.swap(checks);
+  begin.pop_back();
+}
+
+std::string demangle_typestr(const char *name) {
+  int status = -4;
+  std::unique_ptr<char, void (*)(void *)> res{abi::__cxa_demangle(name, NULL, NULL, &status), std::free};
+  return (status == 0) ? res.get() : name;
+}
+
+enum isolated_msg_t : uint32_t { isolated_begin, isolated_done };
+
+struct isolated_header_t {
+  isolated_msg_t type;
+  testcase_entry_t entry;
+};
+
+struct isolated_worker_t {
+  pid_t pid = -1;
+  int task_fd = -1;
+  int result_fd = -1;
+  int64_t current = -1;
+  uint64_t dispatched_ns = 0;
+  uint64_t records_mark = 0;
+  testcase_entry_t entry{};
+};
+
+struct finished_testcase_t {
+  testcase_entry_t entry;
+  uint64_t records_mark;
+};
+
+struct ring_slot_t {
+  std::atomic<uint64_t> sequence;
+  test_info_t record;
+};
+
+// Bounded multi-producer queue (Vyukov) living in a MAP_SHARED mapping inherited by every worker process. Every
+// producer thread publishes the position it is about to claim in its own claims[] entry before taking it, so the
+// parent can tell a slot whose owner died before committing it from one that is still being written.
+struct shared_ring_t {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  uint64_t mask;
+  uint64_t workers_num;
+  std::atomic<uint64_t> *claims;
+  ring_slot_t *slots;
+};
+
+static constexpr uint64_t shared_ring_size = 1 << 16;
+static constexpr uint64_t claims_per_worker = 64;
+
+// A claims[] entry is free, held idle by a producer thread, or holds the position being claimed + 2
+static constexpr uint64_t claim_free = 0;
+static constexpr uint64_t claim_idle = 1;
+
+shared_ring_t *p_shared_ring = nullptr;
+static int isolated_fd = -1;
+static uint64_t isolated_index = 0;
+
+static shared_ring_t *create_shared_ring(uint64_t workers_num) {
+  size_t size = sizeof(shared_ring_t) + workers_num * claims_per_worker * sizeof(std::atomic<uint64_t>) +
+                shared_ring_size * sizeof(ring_slot_t);
+  void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return nullptr;
+
+  shared_ring_t *ring = new (mem) shared_ring_t;
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->tail.store(0, std::memory_order_relaxed);
+  ring->mask = shared_ring_size - 1;
+  ring->workers_num = workers_num;
+  ring->claims = new (ring + 1) std::atomic<uint64_t>[workers_num * claims_per_worker];
+  ring->slots = new (ring->claims + workers_num * claims_per_worker) ring_slot_t[shared_ring_size];
+  for (uint64_t i = 0; i < workers_num * claims_per_worker; i++)
+    ring->claims[i].store(claim_free, std::memory_order_relaxed);
+  for (uint64_t i = 0; i < shared_ring_size; i++)
+    ring->slots[i].sequence.store(i, std::memory_order_relaxed);
+  return ring;
+}
+
+static void destroy_shared_ring(shared_ring_t *ring) {
+  munmap(ring, sizeof(shared_ring_t) + ring->workers_num * claims_per_worker * sizeof(std::atomic<uint64_t>) +
+                   shared_ring_size * sizeof(ring_slot_t));
+}
+
+static void commit_shared_slot(shared_ring_t *ring, uint64_t pos, const test_info_t &record) {
+  ring_slot_t &slot = ring->slots[pos & ring->mask];
+  slot.record = record;
+  slot.sequence.store(pos + 1, std::memory_order_release);
+}
+
+// Every producer thread of a worker holds one of the worker's claims[] entries for as long as it lives
+class claim_entry_t {
+public:
+  ~claim_entry_t() {
+    if (entry)
+      entry->store(claim_free, std::memory_order_release);
+  }
+
+  std::atomic<uint64_t> &get(shared_ring_t *ring) {
+    while (!entry) {
+      std::atomic<uint64_t> *claims = ring->claims + isolated_index * claims_per_worker;
+      for (uint64_t i = 0; i < claims_per_worker && !entry; i++) {
+        uint64_t expected = claim_free;
+        if (claims[i].compare_exchange_strong(expected, claim_idle))
+          entry = &claims[i];
+      }
+
+      // More than claims_per_worker threads checking at once, wait for one of them to exit
+      if (!entry)
+        sched_yield();
+    }
+    return *entry;
+  }
+
+private:
+  std::atomic<uint64_t> *entry = nullptr;
+};
+
+static thread_local claim_entry_t claim_entry;
+
+void push_shared_record(const test_info_t &record) {
+  shared_ring_t *ring = p_shared_ring;
+  std::atomic<uint64_t> &claim = claim_entry.get(ring);
+  uint64_t pos = ring->head.load(std::memory_order_relaxed);
+
+  for (;;) {
+    uint64_t seq = ring->slots[pos & ring->mask].sequence.load(std::memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+    if (diff == 0) {
+      // Published before the CAS, so the owner of a claimed slot can always be found until it commits
+      claim.store(pos + 2, std::memory_order_seq_cst);
+      if (ring->head.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst))
+        break;
+    } else if (diff < 0) {
+      // Full, wait for the parent to drain
+      sched_yield();
+      pos = ring->head.load(std::memory_order_relaxed);
+    } else {
+      pos = ring->head.load(std::memory_order_relaxed);
+    }
+  }
+
+  commit_shared_slot(ring, pos, record);
+  claim.store(claim_idle, std::memory_order_release);
+}
+
+static bool is_claimed(shared_ring_t *ring, uint64_t pos) {
+  for (uint64_t i = 0; i < ring->workers_num * claims_per_worker; i++)
+    if (ring->claims[i].load(std::memory_order_seq_cst) == pos + 2)
+      return true;
+  return false;
+}
+
+static void drain_shared_ring(shared_ring_t *ring, results_buffer_t &results) {
+  uint64_t pos = ring->tail.load(std::memory_order_relaxed);
+
+  for (;;) {
+    ring_slot_t &slot = ring->slots[pos & ring->mask];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+      // Taken but uncommitted and claimed by nobody: its owner died between the CAS and the commit, skip it
+      if (pos >= ring->head.load(std::memory_order_seq_cst) || is_claimed(ring, pos))
+        break;
+      if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+        commit_shared_slot(ring, pos, test_info_t{});
+    }
+
+    if (slot.record.site) {
+      results.test_results.push_back(slot.record);
+      results.test_results.back().number = results.asserts_counter++;
+    }
+    slot.sequence.store(pos + ring->mask + 1, std::memory_order_release);
+    ring->tail.store(++pos, std::memory_order_relaxed);
+  }
+}
+
+static bool write_full(int fd, const void *buf, size_t size) {
+  const char *p = static_cast<const char *>(buf);
+  while (size) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+static bool read_full(int fd, void *buf, size_t size) {
+  char *p = static_cast<char *>(buf);
+  while (size) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+// Every thread formats into its own buffer, a testcase is written out in one block when it ends so the output
+// of concurrent cases is never interleaved. Output outside of a testcase goes out immediately.
+void flush_output(void) {
+  std::pmr::string &output = local_results().output;
+  if (output.empty())
+    return;
+
+  std::lock_guard<std::mutex> lock(output_mtx);
+  std::fflush(stdout);
+  write_full(STDOUT_FILENO, output.data(), output.size());
+  output.clear();
+}
+
+void output_printf(const char *format, ...) {
+  std::pmr::string &output = local_results().output;
+  char line[256];
+  va_list args, retry;
+  va_start(args, format);
+  va_copy(retry, args);
+  int len = std::vsnprintf(line, sizeof(line), format, args);
+  if (len >= int(sizeof(line))) {
+    size_t offset = output.size();
+    output.resize(offset + len + 1);
+    std::vsnprintf(&output[offset], len + 1, format, retry);
+    output.pop_back();
+  } else if (len > 0) {
+    output.append(line, len);
+  }
+
+  va_end(retry);
+  va_end(args);
+  if (!in_testcase || output.size() >= output_flush_size)
+    flush_output();
+}
+
+void output_write(const std::string &str) {
+  std::pmr::string &output = local_results().output;
+  output.append(str);
+  if (!in_testcase || output.size() >= output_flush_size)
+    flush_output();
+}
+
+static const char *perf_event_names[perf_events_num] = {"cycles", "instructions", "cache misses", "branch misses"};
+static const char *perf_event_keys[perf_events_num] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static std::atomic<unsigned> perf_available{0};
+static std::atomic<int> perf_errno{0};
+
+// Every thread counts itself with one counter per event, events the CPU or the container does not provide are
+// left out and reported as n/a
+static void open_perf_counters(results_buffer_t &results) {
+  static const uint64_t configs[perf_events_num] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for (int i = 0; i < perf_events_num; i++) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    results.perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (results.perf_fds[i] >= 0)
+      perf_available |= 1u << i;
+    else
+      perf_errno = errno;
+  }
+
+  results.perf_opened = true;
+}
+
+static void close_perf_counters(results_buffer_t &results) {
+  for (int i = 0; results.perf_opened && i < perf_events_num; i++)
+    if (results.perf_fds[i] >= 0)
+      close(results.perf_fds[i]);
+  results.perf_opened = false;
+}
+
+static void read_perf_counters(results_buffer_t &results, uint64_t *values) {
+  if (!results.perf_opened)
+    open_perf_counters(results);
+  for (int i = 0; i < perf_events_num; i++)
+    if (results.perf_fds[i] < 0 || read(results.perf_fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      values[i] = 0;
+}
+
+static void send_testcase(isolated_msg_t type) {
+  results_buffer_t &results = local_results();
+  isolated_header_t header{type, testcase_entry_t{current_case, 0, 0, 0, 0}};
+  if (type == isolated_done) {
+    header.entry = results.testcases.back();
+    results.testcases.clear();
+  }
+
+  write_full(isolated_fd, &header, sizeof(header));
+}
+
+static uint64_t wall_clock_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static uint64_t thread_cpu_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static std::FILE *junit_report = nullptr;
+static std::FILE *json_report = nullptr;
+static std::mutex report_mtx;
+
+static std::string xml_escape(const char *str) {
+  std::string escaped;
+  for (; *str; str++) {
+    switch (*str) {
+    case '&':
+      escaped += "&amp;";
+      break;
+    case '<':
+      escaped += "&lt;";
+      break;
+    case '>':
+      escaped += "&gt;";
+      break;
+    case '"':
+      escaped += "&quot;";
+      break;
+    default:
+      escaped += *str;
+    }
+  }
+
+  return escaped;
+}
+
+static std::string json_escape(const char *str) {
+  std::string escaped;
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      escaped += '\\';
+      escaped += *str;
+    } else if (uint8_t(*str) < 0x20) {
+      char code[8];
+      std::snprintf(code, sizeof(code), "\\u%04x", *str);
+      escaped += code;
+    } else {
+      escaped += *str;
+    }
+  }
+
+  return escaped;
+}
+
+static std::FILE *open_report(const char *path) {
+  std::FILE *file = std::fopen(path, "w");
+  if (!file)
+    std::perror(path);
+  return file;
+}
+
+void open_reports(void) {
+  if (opts.output_junit && (junit_report = open_report(opts.output_junit)))
+    std::fprintf(junit_report, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n  <testsuite name=\"%s\">\n",
+                 xml_escape(progname).c_str());
+  if (opts.output_json)
+    json_report = open_report(opts.output_json);
+}
+
+void close_reports(void) {
+  std::lock_guard<std::mutex> lock(report_mtx);
+  if (junit_report) {
+    std::fputs("  </testsuite>\n</testsuites>\n", junit_report);
+    std::fclose(junit_report);
+  }
+  if (json_report)
+    std::fclose(json_report);
+  junit_report = json_report = nullptr;
+}
+
+// Written as soon as a case completes, only failures are spelled out so the report never holds the run in memory.
+// [begin, end) may hold records of other cases as well, only those of the entry are taken.
+static void stream_testcase(const testcase_entry_t &entry, const test_info_t *begin, const test_info_t *end) {
+  if (!junit_report && !json_report)
+    return;
+
+  uint64_t pass_count = entry.fast_passes;
+  std::vector<const test_info_t *> failures;
+  for (const test_info_t *check_info = begin; check_info < end; check_info++) {
+    if (check_info->case_id != entry.case_id)
+      continue;
+    if (check_info->ok)
+      pass_count++;
+    else
+      failures.push_back(check_info);
+  }
+
+  static const case_info_t outside_info{"", "<outside of testcases>", 0};
+  const case_info_t &info = (entry.case_id != no_case) ? report.cases[entry.case_id] : outside_info;
+  std::string junit, json;
+  if (junit_report) {
+    char line[512];
+    std::snprintf(line, sizeof(line), "    <testcase classname=\"%s\" name=\"%s\" time=\"%.6f\" assertions=\"%lu\">\n",
+                  xml_escape(info.ts_name).c_str(), xml_escape(info.tc_name).c_str(), entry.wall_ns / 1e9,
+                  pass_count + failures.size());
+    junit = line;
+    if (opts.perf_counters && perf_available) {
+      junit += "      <properties>\n";
+      for (int i = 0; i < perf_events_num; i++)
+        if (perf_available & (1u << i))
+          junit += std::string("        <property name=\"") + perf_event_keys[i] + "\" value=\"" +
+                   std::to_string(entry.perf[i]) + "\"/>\n";
+      junit += "      </properties>\n";
+    }
+    for (const test_info_t *check_info : failures) {
+      const assert_site_t *site = check_info->site;
+      junit += std::string("      <failure type=\"") + op_name(site) + "\" message=\"" + op_name(site) + "( " +
+               xml_escape(site->exp1_str) + ", " + xml_escape(site->exp2_str) + " ) at " + xml_escape(site->file) +
+               ":" + std::to_string(site->line) + "\"/>\n";
+    }
+    junit += "    </testcase>\n";
+  }
+
+  if (json_report) {
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"suite\":\"%s\",\"case\":\"%s\",\"passed\":%lu,\"failed\":%zu,\"wall_ns\":%lu,\"cpu_ns\":%lu,"
+                  "\"failures\":[",
+                  json_escape(info.ts_name).c_str(), json_escape(info.tc_name).c_str(), pass_count, failures.size(),
+                  entry.wall_ns, entry.cpu_ns);
+    json = line;
+    for (const test_info_t *check_info : failures) {
+      const assert_site_t *site = check_info->site;
+      json += std::string(check_info == failures.front() ? "" : ",") + "{\"check\":\"" + op_name(site) +
+              "\",\"exp1\":\"" + json_escape(site->exp1_str) + "\",\"exp2\":\"" + json_escape(site->exp2_str) +
+              "\",\"file\":\"" + json_escape(site->file) + "\",\"line\":" + std::to_string(site->line) + "}";
+    }
+    json += "]";
+    if (opts.perf_counters && perf_available) {
+      json += ",\"perf\":{";
+      for (int i = 0; i < perf_events_num; i++)
+        if (perf_available & (1u << i))
+          json += std::string(json.back() == '{' ? "\"" : ",\"") + perf_event_keys[i] +
+                  "\":" + std::to_string(entry.perf[i]);
+      json += "}";
+    }
+    json += "}\n";
+  }
+
+  std::lock_guard<std::mutex> lock(report_mtx);
+  if (junit_report)
+    std::fputs(junit.c_str(), junit_report);
+  if (json_report)
+    std::fputs(json.c_str(), json_report);
+}
+
+void push_foreign_record(const test_info_t &record) {
+  std::lock_guard<std::mutex> lock(foreign_mtx);
+  foreign_records.push_back(record);
+  foreign_count.store(foreign_records.size(), std::memory_order_release);
+}
+
+// The body joined its threads before returning, so their records of the case are all in by now
+static uint64_t take_foreign_records(case_id_t id, results_buffer_t &results) {
+  if (!foreign_count.load(std::memory_order_acquire))
+    return 0;
+
+  std::lock_guard<std::mutex> lock(foreign_mtx);
+  auto taken = std::stable_partition(foreign_records.begin(), foreign_records.end(),
+                                     [id](const test_info_t &check_info) { return check_info.case_id != id; });
+  uint64_t count = foreign_records.end() - taken;
+  results.test_results.insert(results.test_results.end(), taken, foreign_records.end());
+  foreign_records.erase(taken, foreign_records.end());
+  foreign_count.store(foreign_records.size(), std::memory_order_relaxed);
+  return count;
+}
+
+// Checks outside of testcases are only known once the run is merged, they are written as one last entry
+void stream_outside_checks(void) {
+  const testcase_report_t &outside = report.outside;
+  if (!outside.passed && !outside.failed)
+    return;
+
+  uint64_t first = report.checks_begin[report.cases.size()];
+  uint64_t last = report.checks_begin[report.cases.size() + 1];
+  stream_testcase(testcase_entry_t{}, report.checks.data() + first, report.checks.data() + last);
+}
+
+void begin_testcase(case_id_t id) {
+  current_case = id;
+  uint64_t state = running_cases.load(std::memory_order_relaxed);
+  while (!running_cases.compare_exchange_weak(state, ((state >> 32) + 1) << 32 | (state >> 32 ? no_case : id)))
+    ;
+
+  results_buffer_t &results = local_results();
+  results.testcases.push_back(testcase_entry_t{id, 0, 0, 0, 0});
+  results.fast_passes_mark = results.fast_passes;
+  results.records_mark = results.asserts_counter;
+  in_testcase = true;
+  if (opts.verbose_level > 1)
+    output_printf("\r\nRunning %s : %s ... \r\n\r\n", report.cases[id].ts_name, report.cases[id].tc_name);
+
+  if (isolated_fd >= 0)
+    send_testcase(isolated_begin);
+
+  if (opts.perf_counters)
+    read_perf_counters(results, results.perf_mark);
+  results.cpu_mark = thread_cpu_ns();
+  results.wall_mark = wall_clock_ns();
+#ifdef TEST_COUNT_ALLOCS
+  static std::atomic<uint64_t> alloc_epochs{0};
+  alloc_counters = alloc_counters_t{true, ++alloc_epochs, 0, 0, 0};
+#endif
+}
+
+void end_testcase(void) {
+  uint64_t wall_ns = wall_clock_ns();
+  uint64_t cpu_ns = thread_cpu_ns();
+  results_buffer_t &results = local_results();
+  if (opts.perf_counters) {
+    uint64_t *perf = results.testcases.back().perf;
+    read_perf_counters(results, perf);
+    for (int i = 0; i < perf_events_num; i++)
+      perf[i] -= results.perf_mark[i];
+  }
+#ifdef TEST_COUNT_ALLOCS
+  alloc_counters.active = false;
+  results.testcases.back().allocations = alloc_counters.allocations;
+  results.testcases.back().alloc_bytes = alloc_counters.bytes;
+  results.testcases.back().outstanding_bytes = alloc_counters.bytes - alloc_counters.freed_bytes;
+#endif
+  testcase_entry_t &entry = results.testcases.back();
+  entry.fast_passes = results.fast_passes - results.fast_passes_mark;
+  entry.wall_ns = wall_ns - results.wall_mark;
+  entry.cpu_ns = cpu_ns - results.cpu_mark;
+  entry.records = results.asserts_counter - results.records_mark + take_foreign_records(entry.case_id, results);
+  in_testcase = false;
+  current_case = no_case;
+
+  // The case left running alone is not known here, until the next one starts alone nobody is the running case
+  uint64_t state = running_cases.load(std::memory_order_relaxed);
+  while (!running_cases.compare_exchange_weak(state, ((state >> 32) - 1) << 32 | no_case))
+    ;
+  flush_output();
+
+  // Isolated workers publish their records through the ring, the parent streams their cases
+  if (isolated_fd < 0)
+    stream_testcase(entry, results.test_results.data() + results.test_results.size() - entry.records,
+                    results.test_results.data() + results.test_results.size());
+}
+
+static std::string full_name(const char *ts, const char *tc) { return std::string(ts) + "." + tc; }
+
+static std::map<std::string, uint64_t> timing_history;
+static uint64_t timing_default_ns = 0;
+
+static void load_timing_cache(const char *path) {
+  std::FILE *file = std::fopen(path, "r");
+  if (!file)
+    return;
+
+  char name[512];
+  unsigned long wall_ns;
+  while (std::fscanf(file, "%511s %lu", name, &wall_ns) == 2)
+    timing_history[name] = wall_ns;
+  std::fclose(file);
+
+  // Cases without history are expected to take an average time
+  for (const auto &[name, ns] : timing_history)
+    timing_default_ns += ns / timing_history.size();
+}
+
+static void save_timing_cache(const char *path) {
+  for (case_id_t id = 0; id < report.cases.size(); id++)
+    if (report.testcases[id].wall_ns)
+      timing_history[full_name(report.cases[id].ts_name, report.cases[id].tc_name)] = report.testcases[id].wall_ns;
+
+  std::string tmp_path = std::string(path) + ".tmp";
+  std::FILE *file = std::fopen(tmp_path.c_str(), "w");
+  if (!file) {
+    std::perror(tmp_path.c_str());
+    return;
+  }
+
+  for (const auto &[name, ns] : timing_history)
+    std::fprintf(file, "%s %lu\n", name.c_str(), ns);
+  if (std::fclose(file) || std::rename(tmp_path.c_str(), path))
+    std::perror(path);
+}
+
+static uint64_t expected_ns(task_t tc) {
+  auto it = timing_history.find(full_name(tc->ts_name, tc->tc_name));
+  return (it != timing_history.end()) ? it->second : timing_default_ns;
+}
+
+static void run_tests_static(const std::vector<task_t> &tcs, uint64_t threads_num) {
+  std::thread *threads = new std::thread[threads_num];
+  uint64_t tcs_count = tcs.size();
+  uint64_t tc_per_thread_num = (threads_num) ? tcs_count / threads_num : tcs_count;
+  uint64_t tc_leftover = (threads_num) ? tcs_count % threads_num : tcs_count;
+  const task_t *last_tcs = tcs.data() + threads_num * tc_per_thread_num;
+
+  auto thread_task = [](const task_t *start_addr, uint64_t num) -> void {
+    for (uint64_t i = 0; i < num; i++) {
+      start_addr[i]->fn(*start_addr[i]);
+    }
+  };
+
+  for (uint64_t i = 0; i < threads_num; i++) {
+    threads[i] = std::thread(thread_task, tcs.data() + (i * tc_per_thread_num), tc_per_thread_num);
+  }
+
+  std::thread leftover;
+  if (tc_leftover)
+    leftover = std::thread(thread_task, last_tcs, tc_leftover);
+  for (unsigned int i = 0; i < threads_num; i++)
+    threads[i].join();
+  if (leftover.joinable())
+    leftover.join();
+  delete[] threads;
+}
+
+struct alignas(64) worker_queue_t {
+  std::mutex mtx;
+  std::deque<task_t> tasks;
+};
+
+static bool pop_task(worker_queue_t &queue, task_t &tc) {
+  std::lock_guard<std::mutex> lock(queue.mtx);
+  if (queue.tasks.empty())
+    return false;
+  tc = queue.tasks.front();
+  queue.tasks.pop_front();
+  return true;
+}
+
+static bool steal_task(worker_queue_t &queue, task_t &tc) {
+  std::lock_guard<std::mutex> lock(queue.mtx);
+  if (queue.tasks.empty())
+    return false;
+  tc = queue.tasks.back();
+  queue.tasks.pop_back();
+  return true;
+}
+
+static void run_tests_work_stealing(const std::vector<task_t> &tcs, uint64_t threads_num) {
+  if (!threads_num)
+    threads_num = 1;
+
+  // Seed every worker with a contiguous slice, owners pop from the front and thieves take from the back
+  std::vector<worker_queue_t> queues(threads_num);
+  if (timing_history.empty()) {
+    uint64_t tc_per_thread_num = tcs.size() / threads_num;
+    uint64_t tc_leftover = tcs.size() % threads_num;
+    for (uint64_t i = 0, pos = 0; i < threads_num; i++) {
+      uint64_t num = tc_per_thread_num + (i < tc_leftover ? 1 : 0);
+      queues[i].tasks.assign(tcs.begin() + pos, tcs.begin() + pos + num);
+      pos += num;
+    }
+  } else {
+    // Longest processing time first: tcs come longest first and each goes to the least loaded queue
+    std::vector<uint64_t> loads(threads_num);
+    for (task_t tc : tcs) {
+      uint64_t i = std::min_element(loads.begin(), loads.end()) - loads.begin();
+      queues[i].tasks.push_back(tc);
+      loads[i] += expected_ns(tc);
+    }
+  }
+
+  auto thread_task = [&queues, threads_num](uint64_t self) -> void {
+    task_t tc;
+    for (;;) {
+      if (pop_task(queues[self], tc)) {
+        tc->fn(*tc);
+        continue;
+      }
+
+      // Tasks never spawn new tasks, so one fruitless pass over all victims means the run is drained
+      bool stolen = false;
+      for (uint64_t i = 1; i < threads_num && !stolen; i++)
+        stolen = steal_task(queues[(self + i) % threads_num], tc);
+      if (!stolen)
+        return;
+      tc->fn(*tc);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(threads_num);
+  for (uint64_t i = 0; i < threads_num; i++)
+    threads.emplace_back(thread_task, i);
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+static std::vector<void (*)(void)> &fixture_teardowns() {
+  static std::vector<void (*)(void)> teardowns;
+  return teardowns;
+}
+
+void register_fixture_teardown(void (*teardown)(void)) {
+  std::lock_guard<std::mutex> lock(mtx);
+  fixture_teardowns().push_back(teardown);
+}
+
+// The destructors run unlocked, a check in one may register this thread's results buffer under mtx
+void teardown_fixtures(void) {
+  std::vector<void (*)(void)> teardowns;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    teardowns.swap(fixture_teardowns());
+  }
+
+  for (auto it = teardowns.rbegin(); it != teardowns.rend(); ++it)
+    (*it)();
+}
+
+static void record_escaped_exception() {
+  uncounted_scope_t uncounted;
+  static constexpr assert_site_t site{"<isolated>", 0, assert_op_t::crash, true, "testcase", "uncaught exception",
+                                      nullptr};
+  const char *what = "unknown exception";
+  try {
+    if (std::current_exception())
+      std::rethrow_exception(std::current_exception());
+  } catch (const std::exception &e) {
+    what = e.what();
+  } catch (...) {
+  }
+
+  output_printf("[\e[31mFAIL\e[39m] %s : %s terminated by an uncaught exception ( %s )\r\n",
+                report.cases[current_case].ts_name, report.cases[current_case].tc_name, what);
+  record_result(&site, false);
+}
+
+[[noreturn]] static void isolated_terminate() {
+  // Records are already in the shared ring, only the pass count of a failed ASSERT or escaped exception is pending
+  if (in_testcase) {
+    if (!assert_terminated)
+      record_escaped_exception();
+    end_testcase();
+    send_testcase(isolated_done);
+  }
+
+  std::fflush(stdout);
+  std::abort();
+}
+
+[[noreturn]] static void isolated_worker(const std::vector<task_t> &tcs, uint64_t worker_index, int task_fd,
+                                        int result_fd) {
+  results_buffer_t &results = local_results();
+  results.test_results.clear();
+  results.testcases.clear();
+  isolated_index = worker_index;
+  isolated_fd = result_fd;
+  close_perf_counters(results);
+  std::set_terminate(isolated_terminate);
+
+  uint64_t index;
+  while (read_full(task_fd, &index, sizeof(index))) {
+    tcs[index]->fn(*tcs[index]);
+    send_testcase(isolated_done);
+    std::fflush(stdout);
+  }
+
+  teardown_fixtures();
+  std::fflush(stdout);
+  _exit(0);
+}
+
+static bool spawn_worker(std::vector<isolated_worker_t> &workers, isolated_worker_t &worker,
+                         const std::vector<task_t> &tcs, shared_ring_t *ring) {
+  int task_pipe[2], result_pipe[2];
+  if (pipe(task_pipe))
+    return false;
+  if (pipe(result_pipe)) {
+    close(task_pipe[0]);
+    close(task_pipe[1]);
+    return false;
+  }
+
+  // Every stdio buffer is copied into the child, a worker leaving through exit() would write it out a second time
+  std::fflush(nullptr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    p_shared_ring = ring;
+    // Siblings only see EOF on their task pipe if nobody else keeps its write end open
+    for (isolated_worker_t &sibling : workers)
+      if (&sibling != &worker && sibling.pid > 0) {
+        close(sibling.task_fd);
+        close(sibling.result_fd);
+      }
+
+    close(task_pipe[1]);
+    close(result_pipe[0]);
+    isolated_worker(tcs, &worker - workers.data(), task_pipe[0], result_pipe[1]);
+  }
+
+  close(task_pipe[0]);
+  close(result_pipe[1]);
+  if (pid < 0) {
+    close(task_pipe[1]);
+    close(result_pipe[0]);
+    return false;
+  }
+
+  worker.pid = pid;
+  worker.task_fd = task_pipe[1];
+  worker.result_fd = result_pipe[0];
+  worker.current = -1;
+  return true;
+}
+
+static void record_crash(const isolated_worker_t &worker, int status) {
+  static constexpr assert_site_t site{"<isolated>", 0, assert_op_t::crash, true, "worker", "exited abnormally",
+                                      nullptr};
+  const char *ts = report.cases[worker.entry.case_id].ts_name;
+  const char *tc = report.cases[worker.entry.case_id].tc_name;
+
+  if (WIFSIGNALED(status))
+    std::printf("[\e[31mFAIL\e[39m] %s : %s killed by signal %d (%s) in worker %d\r\n", ts, tc, WTERMSIG(status),
+                strsignal(WTERMSIG(status)), worker.pid);
+  else
+    std::printf("[\e[31mFAIL\e[39m] %s : %s exited with status %d in worker %d\r\n", ts, tc, WEXITSTATUS(status),
+                worker.pid);
+
+  results_buffer_t &results = local_results();
+  results.testcases.push_back(testcase_entry_t{worker.entry.case_id, 0, wall_clock_ns() - worker.dispatched_ns, 0, 1});
+  results.test_results.push_back(test_info_t{results.asserts_counter++, &site, worker.entry.case_id, false});
+}
+
+// Records of a finished case can still sit behind a slot another worker has claimed but not committed yet, so a
+// case is only streamed once all of its records have been drained
+static void stream_finished(std::vector<finished_testcase_t> &finished, const results_buffer_t &results, bool all) {
+  const test_info_t *end = results.test_results.data() + results.test_results.size();
+  for (auto it = finished.begin(); it != finished.end();) {
+    const test_info_t *begin = results.test_results.data() + it->records_mark;
+    const testcase_entry_t &entry = it->entry;
+    if (!all && uint64_t(std::count_if(begin, end, [&entry](const test_info_t &check_info) {
+                  return check_info.case_id == entry.case_id;
+                })) < entry.records) {
+      ++it;
+      continue;
+    }
+
+    stream_testcase(entry, begin, end);
+    it = finished.erase(it);
+  }
+}
+
+static void run_tests_isolated(const std::vector<task_t> &tcs, uint64_t workers_num) {
+  std::vector<isolated_worker_t> workers(std::max<uint64_t>(std::min<uint64_t>(workers_num, tcs.size()), 1));
+  std::vector<pollfd> fds(workers.size());
+  results_buffer_t &results = local_results();
+  std::vector<finished_testcase_t> finished;
+  std::deque<uint64_t> pending;
+  for (uint64_t i = 0; i < tcs.size(); i++)
+    pending.push_back(i);
+
+  shared_ring_t *ring = create_shared_ring(workers.size());
+  if (!ring) {
+    std::perror("mmap");
+    std::exit(EXIT_FAILURE);
+  }
+
+  void (*old_sigpipe)(int) = std::signal(SIGPIPE, SIG_IGN);
+  for (isolated_worker_t &worker : workers)
+    if (!spawn_worker(workers, worker, tcs, ring)) {
+      std::perror("fork");
+      std::exit(EXIT_FAILURE);
+    }
+
+  for (;;) {
+    bool busy = false;
+    for (isolated_worker_t &worker : workers) {
+      if (worker.current < 0 && !pending.empty() && write_full(worker.task_fd, &pending.front(), sizeof(uint64_t))) {
+        worker.current = pending.front();
+        pending.pop_front();
+        worker.dispatched_ns = wall_clock_ns();
+        worker.records_mark = results.test_results.size();
+        worker.entry = testcase_entry_t{};
+      }
+
+      busy |= (worker.current >= 0);
+    }
+
+    if (!busy)
+      break;
+
+    for (size_t i = 0; i < workers.size(); i++)
+      fds[i] = pollfd{workers[i].result_fd, POLLIN, 0};
+    // Wake up periodically, workers stall on a full ring without writing anything to their pipes
+    if (poll(fds.data(), fds.size(), 10) < 0 && errno != EINTR) {
+      std::perror("poll");
+      std::exit(EXIT_FAILURE);
+    }
+
+    drain_shared_ring(ring, results);
+
+    for (size_t i = 0; i < workers.size(); i++) {
+      isolated_worker_t &worker = workers[i];
+      isolated_header_t header;
+      if (!fds[i].revents)
+        continue;
+
+      if (!read_full(worker.result_fd, &header, sizeof(header))) {
+        int status = 0;
+        waitpid(worker.pid, &status, 0);
+        close(worker.task_fd);
+        close(worker.result_fd);
+
+        // Releases the claims of the dead worker's threads, the drain then skips any slot it left uncommitted
+        for (uint64_t j = 0; j < claims_per_worker; j++)
+          ring->claims[i * claims_per_worker + j].store(claim_free, std::memory_order_seq_cst);
+        drain_shared_ring(ring, results);
+
+        // A worker may die right after finishing a case, hand a case it never started to somebody else
+        if (worker.current >= 0 && worker.entry.case_id == no_case) {
+          pending.push_front(worker.current);
+        } else if (worker.current >= 0) {
+          record_crash(worker, status);
+          finished.push_back(finished_testcase_t{results.testcases.back(), worker.records_mark});
+        }
+
+        worker.pid = -1;
+        if (!spawn_worker(workers, worker, tcs, ring)) {
+          std::perror("fork");
+          std::exit(EXIT_FAILURE);
+        }
+        continue;
+      }
+
+      worker.entry = header.entry;
+      if (header.type == isolated_done) {
+        results.testcases.push_back(header.entry);
+        finished.push_back(finished_testcase_t{header.entry, worker.records_mark});
+        worker.current = -1;
+      }
+    }
+
+    stream_finished(finished, results, false);
+  }
+
+  for (isolated_worker_t &worker : workers) {
+    close(worker.task_fd);
+    close(worker.result_fd);
+    waitpid(worker.pid, nullptr, 0);
+  }
+
+  drain_shared_ring(ring, results);
+  stream_finished(finished, results, true);
+  destroy_shared_ring(ring);
+  std::signal(SIGPIPE, old_sigpipe);
+}
+
+static uint64_t run_wall_ns = 0;
+
+static bool match_patterns(const std::string &name, const std::string &patterns) {
+  for (size_t pos = 0, end; pos <= patterns.size(); pos = end + 1) {
+    end = std::min(patterns.find(':', pos), patterns.size());
+    if (end > pos && fnmatch(patterns.substr(pos, end - pos).c_str(), name.c_str(), 0) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+// FNV-1a over "Suite.Name", so a case stays on its shard regardless of link order or of the other cases
+static uint64_t name_hash(const char *ts, const char *tc) {
+  uint64_t hash = 14695981039346656037ull;
+  auto feed = [&hash](const char *str) {
+    for (; *str; str++)
+      hash = (hash ^ uint8_t(*str)) * 1099511628211ull;
+  };
+
+  feed(ts);
+  feed(".");
+  feed(tc);
+  return hash;
+}
+
+static bool in_shard(const char *ts, const char *tc) {
+  return opts.shard_count <= 1 || name_hash(ts, tc) % opts.shard_count == uint64_t(opts.shard_index);
+}
+
+// gtest-style selection: "Positive:Patterns-Negative:Patterns", matched against "Suite.Name"
+static bool is_filtered(const char *ts, const char *tc) {
+  if (!opts.filter)
+    return true;
+
+  std::string filter = opts.filter;
+  size_t dash = filter.find('-');
+  std::string positive = filter.substr(0, dash);
+  std::string negative = (dash == std::string::npos) ? "" : filter.substr(dash + 1);
+  std::string name = full_name(ts, tc);
+  return (positive.empty() || match_patterns(name, positive)) && !match_patterns(name, negative);
+}
+
+static bool is_selected(const char *ts, const char *tc) { return in_shard(ts, tc) && is_filtered(ts, tc); }
+
+// With a timing history every shard runs the same LPT assignment over the whole selection, cases without
+// history keep their hashed shard
+static std::vector<task_t> shard_testcases(const std::vector<task_t> &tcs) {
+  std::vector<task_t> shard;
+  std::vector<uint64_t> loads(opts.shard_count);
+  for (task_t tc : tcs) {
+    auto it = timing_history.find(full_name(tc->ts_name, tc->tc_name));
+    if (it == timing_history.end()) {
+      if (in_shard(tc->ts_name, tc->tc_name))
+        shard.push_back(tc);
+      continue;
+    }
+
+    uint64_t index = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    loads[index] += it->second;
+    if (index == uint64_t(opts.shard_index))
+      shard.push_back(tc);
+  }
+
+  return shard;
+}
+
+std::vector<task_t> select_testcases(void) {
+  register_testcases();
+  if (opts.timing_cache && timing_history.empty())
+    load_timing_cache(opts.timing_cache);
+
+  std::vector<task_t> tcs;
+  for (const testcase_t *tc : testcases)
+    if (is_filtered(tc->ts_name, tc->tc_name))
+      tcs.push_back(tc);
+
+  std::sort(tcs.begin(), tcs.end(), [](task_t a, task_t b) { return a->id < b->id; });
+
+  if (timing_history.empty())
+    return (opts.shard_count > 1) ? shard_testcases(tcs) : tcs;
+
+  // Longest first, so the slowest cases start at t=0 on every scheduler instead of at the tail
+  std::vector<std::pair<uint64_t, task_t>> by_duration;
+  for (task_t tc : tcs)
+    by_duration.emplace_back(expected_ns(tc), tc);
+  std::stable_sort(by_duration.begin(), by_duration.end(),
+                   [](const auto &a, const auto &b) { return a.first > b.first; });
+  for (uint64_t i = 0; i < tcs.size(); i++)
+    tcs[i] = by_duration[i].second;
+  return (opts.shard_count > 1) ? shard_testcases(tcs) : tcs;
+}
+
+void list_testcases(void) {
+  for (task_t tc : select_testcases())
+    std::printf("%s.%s (%s:%i)\r\n", tc->ts_name, tc->tc_name, tc->file, tc->line);
+  for (benchmark_t **p = &__start_benchmarks; p < &__stop_benchmarks; p++)
+    if (is_selected((*p)->ts_name, (*p)->bm_name))
+      std::printf("%s.%s (benchmark)\r\n", (*p)->ts_name, (*p)->bm_name);
+}
+
+// A failed ASSERT terminates the run, the failing case must still reach the console and the reports
+static std::terminate_handler default_terminate;
+
+[[noreturn]] static void flush_terminate() {
+  if (in_testcase)
+    end_testcase();
+  flush_output();
+  close_reports();
+  default_terminate();
+  std::abort();
+}
+
+// Static slices are contiguous, cut from the longest first order they would hand all the slow cases to thread 0
+static std::vector<task_t> sorted_by_id(std::vector<task_t> tcs) {
+  std::sort(tcs.begin(), tcs.end(), [](task_t a, task_t b) { return a->id < b->id; });
+  return tcs;
+}
+
+void run_tests() {
+  uint64_t start_ns = wall_clock_ns();
+  default_terminate = std::set_terminate(flush_terminate);
+  // Probe on this thread, -j workers only report counts and the summary needs to know which counters exist
+  if (opts.perf_counters && !local_results().perf_opened)
+    open_perf_counters(local_results());
+  std::vector<task_t> tcs = select_testcases();
+  uint64_t threads_num = opts.threads_num;
+  if (threads_num > tcs.size())
+    threads_num = tcs.size();
+
+  if (opts.isolated_workers)
+    run_tests_isolated(tcs, opts.isolated_workers);
+  else if (opts.static_schedule)
+    run_tests_static(sorted_by_id(tcs), threads_num);
+  else
+    run_tests_work_stealing(tcs, threads_num);
+
+  teardown_fixtures();
+  run_wall_ns = wall_clock_ns() - start_ns;
+}
+
+static void benchmark_noop() {}
+
+__attribute__((noinline)) static uint64_t time_iterations(void (*fn)(void), uint64_t iterations) {
+  uint64_t start_ns = wall_clock_ns();
+  for (uint64_t i = 0; i < iterations; i++) {
+    fn();
+    clobber_memory();
+  }
+
+  return wall_clock_ns() - start_ns;
+}
+
+// Grows the iteration count until one sample takes at least sample_ns, this doubles as the warmup pass
+static uint64_t calibrate_iterations(void (*fn)(void), uint64_t sample_ns) {
+  uint64_t iterations = 1;
+  for (;;) {
+    uint64_t elapsed_ns = time_iterations(fn, iterations);
+    if (elapsed_ns >= sample_ns)
+      return iterations;
+    if (elapsed_ns < sample_ns / 100)
+      iterations *= 10;
+    else
+      iterations = iterations * sample_ns / elapsed_ns + 1;
+  }
+}
+
+static double median_of_sorted(const std::vector<double> &values) {
+  size_t n = values.size();
+  return (n % 2) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static double median_abs_deviation(const std::vector<double> &sorted, double median) {
+  std::vector<double> deviations;
+  for (double value : sorted)
+    deviations.push_back(std::fabs(value - median));
+  std::sort(deviations.begin(), deviations.end());
+  return median_of_sorted(deviations);
+}
+
+static void compute_statistics(std::vector<double> &samples, benchmark_result_t &result) {
+  std::sort(samples.begin(), samples.end());
+  double median = median_of_sorted(samples);
+  double mad = median_abs_deviation(samples, median);
+
+  // Reject samples further than 3 scaled MADs from the median (preemption, frequency changes, page faults)
+  if (mad > 0) {
+    auto outlier = [median, mad](double value) -> bool { return std::fabs(value - median) > 3 * 1.4826 * mad; };
+    samples.erase(std::remove_if(samples.begin(), samples.end(), outlier), samples.end());
+  }
+
+  result.outliers = result.samples - samples.size();
+  result.samples = samples.size();
+  result.ns_per_op = median_of_sorted(samples);
+  result.mad_ns_per_op = median_abs_deviation(samples, result.ns_per_op);
+  result.min_ns_per_op = samples.front();
+  result.max_ns_per_op = samples.back();
+
+  // Distribution-free 95% confidence interval of the median from order statistics
+  double n = samples.size();
+  double half_width = 1.96 * std::sqrt(n) / 2;
+  size_t low = std::max(0.0, std::floor(n / 2 - half_width));
+  size_t high = std::min(n - 1, std::ceil(n / 2 + half_width) - 1);
+  result.ci_low_ns_per_op = samples[low];
+  result.ci_high_ns_per_op = samples[std::max(low, high)];
+}
+
+static benchmark_result_t run_benchmark(const benchmark_t *benchmark, double overhead_ns, uint64_t sample_ns) {
+  uint64_t samples_num = std::max(opts.benchmark_samples, 1);
+  benchmark_result_t result{};
+  result.benchmark = benchmark;
+  result.iterations = calibrate_iterations(benchmark->fn, sample_ns);
+  result.samples = samples_num;
+  std::vector<double> samples(samples_num);
+  uint64_t perf_begin[perf_events_num], perf_end[perf_events_num];
+
+  if (opts.perf_counters)
+    read_perf_counters(local_results(), perf_begin);
+  for (double &sample : samples)
+    sample = std::max(0.0, double(time_iterations(benchmark->fn, result.iterations)) / result.iterations - overhead_ns);
+  if (opts.perf_counters) {
+    read_perf_counters(local_results(), perf_end);
+    for (int i = 0; i < perf_events_num; i++)
+      result.perf_per_op[i] = double(perf_end[i] - perf_begin[i]) / (result.iterations * samples_num);
+  }
+
+  compute_statistics(samples, result);
+  return result;
+}
+
+static std::map<std::string, double> load_baseline(const char *path) {
+  std::map<std::string, double> baseline;
+  std::FILE *file = std::fopen(path, "r");
+  if (!file) {
+    std::printf("Benchmark baseline %s is not readable, nothing to compare against\r\n", path);
+    return baseline;
+  }
+
+  char name[512];
+  double ns_per_op, mad_ns_per_op;
+  while (std::fscanf(file, "%511s %lf %lf", name, &ns_per_op, &mad_ns_per_op) == 3)
+    baseline[name] = ns_per_op;
+  std::fclose(file);
+  return baseline;
+}
+
+static void save_baseline(const char *path) {
+  std::FILE *file = std::fopen(path, "w");
+  if (!file) {
+    std::perror(path);
+    return;
+  }
 
-std::string demangle_typestr(const char *name) {
-  int status = -4;
-  std::unique_ptr<char, void (*)(void *)> res{abi::__cxa_demangle(name, NULL, NULL, &status), std::free};
-  return (status == 0) ? res.get() : name;
+  for (const benchmark_result_t &result : benchmark_results)
+    std::fprintf(file, "%s.%s %.6f %.6f\n", result.benchmark->ts_name, result.benchmark->bm_name, result.ns_per_op,
+                 result.mad_ns_per_op);
+  std::fclose(file);
 }
 
-void run_tests() {
-  std::thread *threads = new std::thread[opts.threads_num];
-  uint64_t tcs_count = &__stop_testcases - &__start_testcases;
-  if (opts.threads_num > tcs_count)
-    opts.threads_num = tcs_count;
-  uint64_t tc_per_thread_num = (opts.threads_num) ? tcs_count / opts.threads_num : tcs_count;
+static void compare_with_baseline(benchmark_result_t &result, const std::map<std::string, double> &baseline) {
+  static constexpr assert_site_t site{"<benchmark>", 0, assert_op_t::regression, false, "ns/op", "baseline", nullptr};
+  auto it = baseline.find(full_name(result.benchmark->ts_name, result.benchmark->bm_name));
+  if (it == baseline.end())
+    return;
 
-  volatile void (**last_tcs)(void) = &__start_testcases + opts.threads_num * tc_per_thread_num;
-  uint64_t tc_leftover = (opts.threads_num) ? (&__stop_testcases - &__start_testcases) % opts.threads_num
-                                            : &__stop_testcases - &__start_testcases;
+  // Only a regression if even the optimistic end of the confidence interval is past the threshold
+  result.baseline_ns_per_op = it->second;
+  result.regressed = result.ci_low_ns_per_op > it->second * (1 + opts.benchmark_threshold / 100);
 
-  auto thread_task = [](volatile void (**start_addr)(void), uint64_t num) -> void {
-    for (uint64_t i = 0; i < num; i++) {
-      (*(start_addr + i))();
-    }
+  results_buffer_t &results = local_results();
+  results.testcases.push_back(testcase_entry_t{result.benchmark->id, 0, 0, 0, 1});
+  results.test_results.push_back(
+      test_info_t{results.asserts_counter++, &site, result.benchmark->id, !result.regressed});
+  stream_testcase(results.testcases.back(), &results.test_results.back(), &results.test_results.back() + 1);
+}
+
+void run_benchmarks() {
+  register_testcases();
+  std::vector<const benchmark_t *> benchmarks;
+  for (benchmark_t **p = &__start_benchmarks; p < &__stop_benchmarks; p++)
+    if (is_selected((*p)->ts_name, (*p)->bm_name))
+      benchmarks.push_back(*p);
+  uint64_t sample_ns = opts.benchmark_sample_ms * 1000000ull;
+  if (benchmarks.empty())
+    return;
+
+  // Cost of the indirect call and the loop itself, subtracted from every benchmark
+  uint64_t noop_iterations = calibrate_iterations(benchmark_noop, sample_ns);
+  double overhead_ns = double(time_iterations(benchmark_noop, noop_iterations)) / noop_iterations;
+  std::map<std::string, double> baseline;
+  if (opts.benchmark_baseline)
+    baseline = load_baseline(opts.benchmark_baseline);
+
+  for (const benchmark_t *benchmark : benchmarks) {
+    if (opts.verbose_level > 1)
+      std::printf("\r\nRunning benchmark %s : %s ... \r\n", benchmark->ts_name, benchmark->bm_name);
+    benchmark_results.push_back(run_benchmark(benchmark, overhead_ns, sample_ns));
+    compare_with_baseline(benchmark_results.back(), baseline);
+  }
+
+  if (opts.benchmark_save)
+    save_baseline(opts.benchmark_save);
+}
+
+#define SELF_BENCHMARK_CHECK EXPECT_EQ(values[0], values[1], "self benchmark");
+#define SELF_BENCHMARK_CHECKS_4 SELF_BENCHMARK_CHECK SELF_BENCHMARK_CHECK SELF_BENCHMARK_CHECK SELF_BENCHMARK_CHECK
+static constexpr uint64_t self_benchmark_checks = 16;
+
+// begin and end bracket the code the check macros leave inline here, the outlined failure paths are not in it. This
+// is test.cpp compiled with its own flags: a rough indicator, checks in the user's files may come out differently
+__attribute__((noinline)) static uint64_t self_benchmark_run(const volatile int *values, uint64_t iterations) {
+  for (uint64_t i = 0; i < iterations; i++) {
+  begin:
+    SELF_BENCHMARK_CHECKS_4 SELF_BENCHMARK_CHECKS_4 SELF_BENCHMARK_CHECKS_4 SELF_BENCHMARK_CHECKS_4
+  end:;
+  }
+  return reinterpret_cast<uintptr_t>(&&end) - reinterpret_cast<uintptr_t>(&&begin);
+}
+
+static double self_benchmark_ns(const volatile int *values, bool fast_pass, uint64_t iterations) {
+  bool saved_fast_pass = opts.fast_pass;
+  opts.fast_pass = fast_pass;
+
+  // The warm up run leaves the records storage grown and faulted in, clear() keeps its capacity
+  self_benchmark_run(values, iterations);
+  local_results().test_results.clear();
+  uint64_t start = wall_clock_ns();
+  self_benchmark_run(values, iterations);
+  uint64_t elapsed = wall_clock_ns() - start;
+  local_results().test_results.clear();
+  opts.fast_pass = saved_fast_pass;
+  return double(elapsed) / (iterations * self_benchmark_checks);
+}
+
+void self_benchmark(void) {
+  static const volatile int values[2] = {1, 1};
+  int64_t code_bytes = self_benchmark_run(values, 0);
+  double fast_ns = self_benchmark_ns(values, true, 1 << 20);
+  double recorded_ns = self_benchmark_ns(values, false, 1 << 16);
+
+  std::printf("[\e[33mSELF BENCHMARK\e[39m] :\r\n");
+  if (code_bytes > 0)
+    std::printf("\tEXPECT_EQ built with the framework's flags leaves about %.1f bytes of code inline\r\n",
+                double(code_bytes) / self_benchmark_checks);
+  else
+    std::printf("\tEXPECT_EQ code size is unavailable at the framework's optimization level, the compiler moved the "
+                "measured block\r\n");
+  std::printf("\tA passing EXPECT_EQ takes %.2f ns when recorded, %.2f ns with -f\r\n", recorded_ns, fast_ns);
+}
+
+const char *op_name(const assert_site_t *site) {
+  static const char *names[][2] = {
+      {"EXPECT_EQ", "ASSERT_EQ"},
+      {"EXPECT_NOT_EQ", "ASSERT_NOT_EQ"},
+      {"EXPECT_STREQ", "ASSERT_STREQ"},
+      {"EXPECT_NOT_STREQ", "ASSERT_NOT_STREQ"},
+      {"CRASH", "CRASH"},
+      {"BENCHMARK_REGRESSION", "BENCHMARK_REGRESSION"},
+      {"EXPECT_MAX_ALLOCS", "ASSERT_MAX_ALLOCS"},
+      {"EXPECT_RANGE_EQ", "ASSERT_RANGE_EQ"},
+      {"EXPECT_BYTES_EQ", "ASSERT_BYTES_EQ"},
+      {"EXPECT_ARRAY_NEAR", "ASSERT_ARRAY_NEAR"},
+      {"EXPECT_ARRAY_ULP", "ASSERT_ARRAY_ULP"},
+      {"EXPECT_MATCHES_GOLDEN", "ASSERT_MATCHES_GOLDEN"},
   };
 
-  for (uint64_t i = 0; i < opts.threads_num; i++) {
-    threads[i] = std::thread(thread_task, &__start_testcases + (i * tc_per_thread_num), tc_per_thread_num);
+  return names[static_cast<int>(site->op)][site->fatal];
+}
+
+void print_check(const assert_site_t *site, bool ok) {
+  static const char *relations[][2] = {{"!=", "=="}, {"==", "!="}, {"!=", "=="}, {"==", "!="},
+                                       {"", ""},     {"", ""},     {">", "<="}, {"!=", "=="},
+                                       {"!=", "=="}, {"!~", "~"},  {"!~", "~"},  {"!=", "=="}};
+  output_printf(ok ? "#%lu [\e[32mOK\e[39m] (%s %s %s) At %s:%i, in thread #0x%lx\r\n"
+                   : "#%lu [\e[31mFAIL\e[39m] (%s %s %s) At %s:%i, in thread #0x%lx\r\n",
+                local_results().asserts_counter, site->exp1_str, relations[static_cast<int>(site->op)][ok],
+                site->exp2_str, site->file, site->line, std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+bool record_pass(const assert_site_t *site) {
+  if (running_case() != no_case && opts.verbose_level > 1) {
+    uncounted_scope_t uncounted;
+    print_check(site, true);
   }
+  return record_result(site, true);
+}
 
-  std::thread leftover;
-  if (tc_leftover)
-    leftover = std::thread(thread_task, last_tcs, tc_leftover);
-  for (unsigned int i = 0; i < opts.threads_num; i++)
-    threads[i].join();
-  if (leftover.joinable())
-    leftover.join();
-  delete[] threads;
+static void print_comment(const assert_site_t *site) {
+  if (site->comment)
+    output_printf("%s\r\n", site->comment);
 }
 
-bool assert_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                              const char *exp2_str) {
-  bool ok = (std::strcmp(exp1, exp2) == 0);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  if (!ok)
+bool check_failed(const assert_site_t *site) {
+  uncounted_scope_t uncounted;
+  print_comment(site);
+  record_result(site, false);
+  if (site->fatal) {
+    assert_terminated = true;
     std::terminate();
-  return ok;
+  }
+  return false;
 }
 
-bool assert_not_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                                  const char *exp2_str) {
-  bool ok = (std::strcmp(exp1, exp2) != 0);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  if (!ok)
-    std::terminate();
-  return ok;
+bool record_exception(const assert_site_t *site, const std::exception &e) {
+  uncounted_scope_t uncounted;
+  output_printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( %s ). Terminating ...\r\n",
+                local_results().asserts_counter, site->file, site->line, e.what());
+  return check_failed(site);
 }
 
-bool expect_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                              const char *exp2_str) {
-  bool ok = (std::strcmp(exp1, exp2) == 0);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  return ok;
+[[gnu::cold, gnu::noinline]] static bool check_strings_failed(const assert_site_t *site, const char *exp1,
+                                                              const char *exp2) {
+  uncounted_scope_t uncounted;
+  if (running_case() != no_case) {
+    print_check(site, false);
+    if (opts.verbose_level > 1)
+      output_printf("( \"%s\", \"%s\" )\n\n", exp1 ? exp1 : "nullptr", exp2 ? exp2 : "nullptr");
+  }
+  return check_failed(site);
 }
 
-bool expect_not_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                                  const char *exp2_str) {
-  bool ok = (std::strcmp(exp1, exp2) != 0);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  return ok;
+static bool check_strings(const assert_site_t *site, bool ok, const char *exp1, const char *exp2) {
+  if (__builtin_expect(ok, 1))
+    return check_passed(site);
+  return check_strings_failed(site, exp1, exp2);
 }
 
-bool assert_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                      const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (std::strcmp(exp1, exp2) == 0);
-  std::lock_guard<std::mutex> lock(mtx);
+static bool str_equal(const char *exp1, const char *exp2) {
+  return (exp1 && exp2) ? std::strcmp(exp1, exp2) == 0 : exp1 == exp2;
+}
 
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s == %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s != %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok) {
-    if constexpr ((!std::is_null_pointer_v<decltype(exp1)> && !std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \"" << exp2 << "\" )" << std::endl << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp1)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \""
-                  << "nullptr"
-                  << "\", \"" << exp2 << "\" )" << std::endl
-                  << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \""
-                  << "nullptr"
-                  << "\" )" << std::endl
-                  << std::endl;
-    }
-  }
-
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "ASSERT_STREQ", exp1_str, exp2_str));
-  asserts_counter++;
-
-  if (!ok)
-    std::terminate();
-  return ok;
+bool assert_str_equal(const char *exp1, const char *exp2, const assert_site_t *site) {
+  return check_strings(site, str_equal(exp1, exp2), exp1, exp2);
 }
 
-bool assert_not_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                          const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (std::strcmp(exp1, exp2) != 0);
-  std::lock_guard<std::mutex> lock(mtx);
+bool assert_not_str_equal(const char *exp1, const char *exp2, const assert_site_t *site) {
+  return check_strings(site, !str_equal(exp1, exp2), exp1, exp2);
+}
 
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s != %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s == %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok) {
-    if constexpr ((!std::is_null_pointer_v<decltype(exp1)> && !std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \"" << exp2 << "\" )" << std::endl << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp1)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \""
-                  << "nullptr"
-                  << "\", \"" << exp2 << "\" )" << std::endl
-                  << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \""
-                  << "nullptr"
-                  << "\" )" << std::endl
-                  << std::endl;
-    }
-  }
-
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "ASSERT_NOT_STREQ", exp1_str, exp2_str));
-  asserts_counter++;
-
-  if (!ok)
-    std::terminate();
-  return ok;
+bool expect_str_equal(const char *exp1, const char *exp2, const assert_site_t *site) {
+  return check_strings(site, str_equal(exp1, exp2), exp1, exp2);
 }
 
-bool expect_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                      const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (std::strcmp(exp1, exp2) == 0);
-  std::lock_guard<std::mutex> lock(mtx);
+bool expect_not_str_equal(const char *exp1, const char *exp2, const assert_site_t *site) {
+  return check_strings(site, !str_equal(exp1, exp2), exp1, exp2);
+}
 
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s == %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s != %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok) {
-    if constexpr ((!std::is_null_pointer_v<decltype(exp1)> && !std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \"" << exp2 << "\" )" << std::endl << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp1)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \""
-                  << "nullptr"
-                  << "\", \"" << exp2 << "\" )" << std::endl
-                  << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \""
-                  << "nullptr"
-                  << "\" )" << std::endl
-                  << std::endl;
-    }
-  }
-
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "EXPECT_EQ", exp1_str, exp2_str));
-  asserts_counter++;
-  return ok;
-}
-
-bool expect_not_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                          const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (std::strcmp(exp1, exp2) != 0);
-  std::lock_guard<std::mutex> lock(mtx);
+// The scalar kernels are the reference, the vector ones only look for the first block that holds a mismatch
+static size_t mismatch_bytes_scalar(const unsigned char *exp1, const unsigned char *exp2, size_t size) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word1, word2;
+    std::memcpy(&word1, exp1 + i, sizeof(word1));
+    std::memcpy(&word2, exp2 + i, sizeof(word2));
+    if (word1 != word2)
+      break;
+  }
+  while (i < size && exp1[i] == exp2[i])
+    i++;
+  return i;
+}
 
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s != %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s == %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok) {
-    if constexpr ((!std::is_null_pointer_v<decltype(exp1)> && !std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \"" << exp2 << "\" )" << std::endl << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp1)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \""
-                  << "nullptr"
-                  << "\", \"" << exp2 << "\" )" << std::endl
-                  << std::endl;
-    } else if constexpr ((std::is_null_pointer_v<decltype(exp2)>)) {
-      if (opts.verbose_level > 1)
-        std::cout << "( \"" << exp1 << "\", \""
-                  << "nullptr"
-                  << "\" )" << std::endl
-                  << std::endl;
-    }
-  }
-
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "EXPECT_NOT_STREQ", exp1_str, exp2_str));
-  asserts_counter++;
-  return ok;
+template <typename T> static size_t mismatch_near_scalar(const T *exp1, const T *exp2, size_t size, T tolerance) {
+  for (size_t i = 0; i < size; i++)
+    if (!(exp1[i] == exp2[i] || std::fabs(exp1[i] - exp2[i]) <= tolerance))
+      return i;
+  return size;
 }
 
-void print_results(void) {
-  std::printf("\r\n[\e[33mSUMMARY\e[39m] :\r\n");
+// Maps the bits of a float onto integers ordered like the floats, so that adjacent floats are one apart
+template <typename I, typename T> static I ulp_key(T value) {
+  I bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits >= 0 ? bits : std::numeric_limits<I>::min() - bits;
+}
+
+template <typename I, typename T> static bool within_ulps(T exp1, T exp2, uint64_t max_ulps) {
+  using U = std::make_unsigned_t<I>;
+  if (std::isnan(exp1) || std::isnan(exp2))
+    return false;
+  I key1 = ulp_key<I>(exp1), key2 = ulp_key<I>(exp2);
+  U distance = key1 > key2 ? U(key1) - U(key2) : U(key2) - U(key1);
+  return distance <= max_ulps;
+}
+
+template <typename I, typename T>
+static size_t mismatch_ulp_scalar(const T *exp1, const T *exp2, size_t size, uint64_t max_ulps) {
+  for (size_t i = 0; i < size; i++)
+    if (!within_ulps<I>(exp1[i], exp2[i], max_ulps))
+      return i;
+  return size;
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, AVX2 is checked for at runtime
+static size_t mismatch_bytes_sse2(const unsigned char *exp1, const unsigned char *exp2, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(exp1 + i));
+    __m128i block2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(exp2 + i));
+    unsigned mask = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2))) & 0xffff;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_bytes_scalar(exp1 + i, exp2 + i, size - i);
+}
 
-  for (const std::pair<std::string,
-                       std::map<std::string, std::vector<std::tuple<bool, std::string, std::string, std::string>>>>
-           &testsuite_info : report) {
+static size_t mismatch_near_sse2(const float *exp1, const float *exp2, size_t size, float tolerance) {
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 limit = _mm_set1_ps(tolerance);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128 block1 = _mm_loadu_ps(exp1 + i), block2 = _mm_loadu_ps(exp2 + i);
+    __m128 near = _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(block1, block2), abs_mask), limit);
+    unsigned mask = ~unsigned(_mm_movemask_ps(_mm_or_ps(_mm_cmpeq_ps(block1, block2), near))) & 0xf;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_near_scalar(exp1 + i, exp2 + i, size - i, tolerance);
+}
 
-    uint64_t ts_pass_count = 0;
-    uint64_t ts_fails_count = 0;
-    std::printf("\tIn testsuite [\e[33m%s\e[39m] :\r\n", testsuite_info.first.c_str());
+static size_t mismatch_near_sse2(const double *exp1, const double *exp2, size_t size, double tolerance) {
+  const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffff));
+  const __m128d limit = _mm_set1_pd(tolerance);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    __m128d block1 = _mm_loadu_pd(exp1 + i), block2 = _mm_loadu_pd(exp2 + i);
+    __m128d near = _mm_cmple_pd(_mm_and_pd(_mm_sub_pd(block1, block2), abs_mask), limit);
+    unsigned mask = ~unsigned(_mm_movemask_pd(_mm_or_pd(_mm_cmpeq_pd(block1, block2), near))) & 0x3;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_near_scalar(exp1 + i, exp2 + i, size - i, tolerance);
+}
 
-    for (const std::pair<std::string, std::vector<std::tuple<bool, std::string, std::string, std::string>>>
-             &testcase_info : testsuite_info.second) {
+// Flags the blocks with a NaN, keys of different signs or a distance over max_ulps, the scalar check then decides
+static size_t mismatch_ulp_sse2(const float *exp1, const float *exp2, size_t size, uint64_t max_ulps) {
+  const __m128i limit = _mm_set1_epi32(int32_t(std::min<uint64_t>(max_ulps, INT32_MAX)));
+  const __m128i min = _mm_set1_epi32(INT32_MIN);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128 block1 = _mm_loadu_ps(exp1 + i), block2 = _mm_loadu_ps(exp2 + i);
+    __m128i bits1 = _mm_castps_si128(block1), bits2 = _mm_castps_si128(block2);
+    __m128i sign1 = _mm_srai_epi32(bits1, 31), sign2 = _mm_srai_epi32(bits2, 31);
+    __m128i key1 = _mm_or_si128(_mm_and_si128(sign1, _mm_sub_epi32(min, bits1)), _mm_andnot_si128(sign1, bits1));
+    __m128i key2 = _mm_or_si128(_mm_and_si128(sign2, _mm_sub_epi32(min, bits2)), _mm_andnot_si128(sign2, bits2));
+    __m128i diff = _mm_sub_epi32(key1, key2);
+    __m128i diff_sign = _mm_srai_epi32(diff, 31);
+    __m128i distance = _mm_sub_epi32(_mm_xor_si128(diff, diff_sign), diff_sign);
+    __m128i flagged = _mm_or_si128(_mm_cmpgt_epi32(distance, limit), _mm_srai_epi32(_mm_xor_si128(key1, key2), 31));
+    flagged = _mm_or_si128(flagged, _mm_castps_si128(_mm_cmpunord_ps(block1, block2)));
+    if (_mm_movemask_epi8(flagged)) {
+      size_t index = i + mismatch_ulp_scalar<int32_t>(exp1 + i, exp2 + i, 4, max_ulps);
+      if (index < i + 4)
+        return index;
+    }
+  }
+  return i + mismatch_ulp_scalar<int32_t>(exp1 + i, exp2 + i, size - i, max_ulps);
+}
 
-      uint64_t tc_pass_count = 0;
-      uint64_t tc_fails_count = 0;
-      std::printf("\t\tIn testcase [\e[33m%s\e[39m] :\r\n", testcase_info.first.c_str());
+__attribute__((target("avx2"))) static size_t mismatch_bytes_avx2(const unsigned char *exp1,
+                                                                   const unsigned char *exp2, size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i block1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(exp1 + i));
+    __m256i block2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(exp2 + i));
+    uint32_t mask = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block1, block2)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_bytes_sse2(exp1 + i, exp2 + i, size - i);
+}
 
-      for (const std::tuple<bool, std::string, std::string, std::string> &check_info : testcase_info.second) {
-        if (!std::get<1>(check_info).empty()) {
+__attribute__((target("avx2"))) static size_t mismatch_near_avx2(const float *exp1, const float *exp2, size_t size,
+                                                                  float tolerance) {
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 limit = _mm256_set1_ps(tolerance);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256 block1 = _mm256_loadu_ps(exp1 + i), block2 = _mm256_loadu_ps(exp2 + i);
+    __m256 near = _mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(block1, block2), abs_mask), limit, _CMP_LE_OQ);
+    __m256 ok = _mm256_or_ps(_mm256_cmp_ps(block1, block2, _CMP_EQ_OQ), near);
+    unsigned mask = ~unsigned(_mm256_movemask_ps(ok)) & 0xff;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_near_sse2(exp1 + i, exp2 + i, size - i, tolerance);
+}
 
-          if (std::get<0>(check_info)) {
-            if (opts.verbose_level > 0)
-              std::printf("\t\t\t[\e[32mOK\e[39m] (%s), ( \e[33m%s\e[39m, \e[33m%s\e[39m )\r\n",
-                          std::get<1>(check_info).c_str(), std::get<2>(check_info).c_str(),
-                          std::get<3>(check_info).c_str());
-          } else {
-            std::printf("\t\t\t[\e[31mFAIL\e[39m] (%s), ( \e[33m%s\e[39m, \e[33m%s\e[39m )\r\n",
-                        std::get<1>(check_info).c_str(), std::get<2>(check_info).c_str(),
-                        std::get<3>(check_info).c_str());
-          }
+__attribute__((target("avx2"))) static size_t mismatch_near_avx2(const double *exp1, const double *exp2, size_t size,
+                                                                  double tolerance) {
+  const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffff));
+  const __m256d limit = _mm256_set1_pd(tolerance);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m256d block1 = _mm256_loadu_pd(exp1 + i), block2 = _mm256_loadu_pd(exp2 + i);
+    __m256d near = _mm256_cmp_pd(_mm256_and_pd(_mm256_sub_pd(block1, block2), abs_mask), limit, _CMP_LE_OQ);
+    __m256d ok = _mm256_or_pd(_mm256_cmp_pd(block1, block2, _CMP_EQ_OQ), near);
+    unsigned mask = ~unsigned(_mm256_movemask_pd(ok)) & 0xf;
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + mismatch_near_sse2(exp1 + i, exp2 + i, size - i, tolerance);
+}
 
-          (std::get<0>(check_info)) ? tc_pass_count++ : tc_fails_count++;
-        }
-      }
+__attribute__((target("avx2"))) static size_t mismatch_ulp_avx2(const float *exp1, const float *exp2, size_t size,
+                                                                 uint64_t max_ulps) {
+  const __m256i limit = _mm256_set1_epi32(int32_t(std::min<uint64_t>(max_ulps, INT32_MAX)));
+  const __m256i min = _mm256_set1_epi32(INT32_MIN);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __m256 block1 = _mm256_loadu_ps(exp1 + i), block2 = _mm256_loadu_ps(exp2 + i);
+    __m256i bits1 = _mm256_castps_si256(block1), bits2 = _mm256_castps_si256(block2);
+    __m256i key1 = _mm256_blendv_epi8(bits1, _mm256_sub_epi32(min, bits1), _mm256_srai_epi32(bits1, 31));
+    __m256i key2 = _mm256_blendv_epi8(bits2, _mm256_sub_epi32(min, bits2), _mm256_srai_epi32(bits2, 31));
+    __m256i distance = _mm256_abs_epi32(_mm256_sub_epi32(key1, key2));
+    __m256i flagged =
+        _mm256_or_si256(_mm256_cmpgt_epi32(distance, limit), _mm256_srai_epi32(_mm256_xor_si256(key1, key2), 31));
+    flagged = _mm256_or_si256(flagged, _mm256_castps_si256(_mm256_cmp_ps(block1, block2, _CMP_UNORD_Q)));
+    if (_mm256_movemask_epi8(flagged)) {
+      size_t index = i + mismatch_ulp_scalar<int32_t>(exp1 + i, exp2 + i, 8, max_ulps);
+      if (index < i + 8)
+        return index;
+    }
+  }
+  return i + mismatch_ulp_scalar<int32_t>(exp1 + i, exp2 + i, size - i, max_ulps);
+}
+
+__attribute__((target("avx2"))) static size_t mismatch_ulp_avx2(const double *exp1, const double *exp2, size_t size,
+                                                                 uint64_t max_ulps) {
+  const __m256i limit = _mm256_set1_epi64x(int64_t(std::min<uint64_t>(max_ulps, INT64_MAX)));
+  const __m256i min = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m256d block1 = _mm256_loadu_pd(exp1 + i), block2 = _mm256_loadu_pd(exp2 + i);
+    __m256i bits1 = _mm256_castpd_si256(block1), bits2 = _mm256_castpd_si256(block2);
+    __m256i key1 = _mm256_blendv_epi8(bits1, _mm256_sub_epi64(min, bits1), _mm256_cmpgt_epi64(zero, bits1));
+    __m256i key2 = _mm256_blendv_epi8(bits2, _mm256_sub_epi64(min, bits2), _mm256_cmpgt_epi64(zero, bits2));
+    __m256i diff = _mm256_sub_epi64(key1, key2);
+    __m256i diff_sign = _mm256_cmpgt_epi64(zero, diff);
+    __m256i distance = _mm256_sub_epi64(_mm256_xor_si256(diff, diff_sign), diff_sign);
+    __m256i flagged = _mm256_or_si256(_mm256_cmpgt_epi64(distance, limit),
+                                      _mm256_cmpgt_epi64(zero, _mm256_xor_si256(key1, key2)));
+    flagged = _mm256_or_si256(flagged, _mm256_castpd_si256(_mm256_cmp_pd(block1, block2, _CMP_UNORD_Q)));
+    if (_mm256_movemask_epi8(flagged)) {
+      size_t index = i + mismatch_ulp_scalar<int64_t>(exp1 + i, exp2 + i, 4, max_ulps);
+      if (index < i + 4)
+        return index;
+    }
+  }
+  return i + mismatch_ulp_scalar<int64_t>(exp1 + i, exp2 + i, size - i, max_ulps);
+}
+#endif
+
+struct compare_kernels_t {
+  size_t (*bytes)(const unsigned char *, const unsigned char *, size_t);
+  size_t (*near_float)(const float *, const float *, size_t, float);
+  size_t (*near_double)(const double *, const double *, size_t, double);
+  size_t (*ulp_float)(const float *, const float *, size_t, uint64_t);
+  size_t (*ulp_double)(const double *, const double *, size_t, uint64_t);
+};
+
+static compare_kernels_t select_compare_kernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    return {mismatch_bytes_avx2, mismatch_near_avx2, mismatch_near_avx2, mismatch_ulp_avx2, mismatch_ulp_avx2};
+
+  // SSE2 has no 64-bit compares, double ULPs stay scalar
+  return {mismatch_bytes_sse2, mismatch_near_sse2, mismatch_near_sse2, mismatch_ulp_sse2,
+          mismatch_ulp_scalar<int64_t, double>};
+#else
+  return {mismatch_bytes_scalar, mismatch_near_scalar<float>, mismatch_near_scalar<double>,
+          mismatch_ulp_scalar<int32_t, float>, mismatch_ulp_scalar<int64_t, double>};
+#endif
+}
+
+static const compare_kernels_t &compare_kernels() {
+  static const compare_kernels_t kernels = select_compare_kernels();
+  return kernels;
+}
+
+size_t mismatch_bytes(const void *exp1, const void *exp2, size_t size) {
+  return compare_kernels().bytes(static_cast<const unsigned char *>(exp1), static_cast<const unsigned char *>(exp2),
+                                 size);
+}
+
+size_t mismatch_near(const float *exp1, const float *exp2, size_t size, float tolerance) {
+  return compare_kernels().near_float(exp1, exp2, size, tolerance);
+}
+
+size_t mismatch_near(const double *exp1, const double *exp2, size_t size, double tolerance) {
+  return compare_kernels().near_double(exp1, exp2, size, tolerance);
+}
+
+size_t mismatch_ulp(const float *exp1, const float *exp2, size_t size, uint64_t max_ulps) {
+  return compare_kernels().ulp_float(exp1, exp2, size, max_ulps);
+}
+
+size_t mismatch_ulp(const double *exp1, const double *exp2, size_t size, uint64_t max_ulps) {
+  return compare_kernels().ulp_double(exp1, exp2, size, max_ulps);
+}
+
+void print_mismatch(size_t index, size_t size1, size_t size2) {
+  if (size1 == size2)
+    output_printf("\tFirst mismatch at index %lu of %lu\r\n", index, size1);
+  else
+    output_printf("\tFirst mismatch at index %lu, sizes %lu and %lu\r\n", index, size1, size2);
+}
+
+// Hex dump of the bytes around the mismatch, or the text with the unprintable bytes escaped
+static void print_bytes_window(const char *name, const unsigned char *bytes, size_t size, size_t index, bool text) {
+  static constexpr size_t window = 16;
+  size_t begin = index > window ? index - window : 0;
+  size_t end = std::min(size, index + window + 1);
+  output_printf("\t%s[%lu..%lu) :%s", name, begin, end, text ? " \"" : "");
+  for (size_t i = begin; i < end; i++) {
+    if (text && i == index)
+      output_printf("\e[31m");
+    if (!text)
+      output_printf(i == index ? " [%02x]" : " %02x", bytes[i]);
+    else if (std::isprint(bytes[i]) && bytes[i] != '"' && bytes[i] != '\\')
+      output_printf("%c", bytes[i]);
+    else
+      output_printf("\\x%02x", bytes[i]);
+    if (text && i == index)
+      output_printf("\e[39m");
+  }
+  output_printf("%s\r\n", text ? "\"" : "");
+}
+
+[[gnu::cold, gnu::noinline]] static bool check_bytes_failed(const assert_site_t *site, const void *exp1, size_t size1,
+                                                            const void *exp2, size_t size2, size_t index, bool text) {
+  uncounted_scope_t uncounted;
+  if (running_case() != no_case) {
+    print_check(site, false);
+    if (index < std::max(size1, size2))
+      print_mismatch(index, size1, size2);
+    print_bytes_window(site->exp1_str, static_cast<const unsigned char *>(exp1), size1, index, text);
+    print_bytes_window(site->exp2_str, static_cast<const unsigned char *>(exp2), size2, index, text);
+  }
+  return check_failed(site);
+}
+
+bool check_bytes_equal(const void *exp1, const void *exp2, size_t size, const assert_site_t *site) {
+  size_t index = mismatch_bytes(exp1, exp2, size);
+  if (__builtin_expect(index == size, 1))
+    return check_passed(site);
+  return check_bytes_failed(site, exp1, size, exp2, size, index, false);
+}
+
+// Length-aware, so embedded NULs are compared like any other byte
+static bool check_string_views(const assert_site_t *site, bool equal, std::string_view exp1, std::string_view exp2) {
+  size_t size = std::min(exp1.size(), exp2.size());
+  size_t index = mismatch_bytes(exp1.data(), exp2.data(), size);
+  bool ok = (index == size && exp1.size() == exp2.size()) == equal;
+  if (__builtin_expect(ok, 1))
+    return check_passed(site);
+  return check_bytes_failed(site, exp1.data(), exp1.size(), exp2.data(), exp2.size(), index, true);
+}
+
+bool assert_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site) {
+  return check_string_views(site, true, exp1, exp2);
+}
+
+bool assert_not_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site) {
+  return check_string_views(site, false, exp1, exp2);
+}
+
+bool expect_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site) {
+  return check_string_views(site, true, exp1, exp2);
+}
+
+bool expect_not_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site) {
+  return check_string_views(site, false, exp1, exp2);
+}
+
+// Read-only view of a whole file, mapped rather than read so a large golden file is compared in place
+struct mapped_file_t {
+  explicit mapped_file_t(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      error = errno;
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+      error = errno;
+    } else if (st.st_size > 0) {
+      void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+        error = errno;
+      else
+        data = std::string_view(static_cast<const char *>(map), st.st_size);
+    }
+    close(fd);
+  }
+
+  ~mapped_file_t() {
+    if (!data.empty())
+      munmap(const_cast<char *>(data.data()), data.size());
+  }
+
+  mapped_file_t(const mapped_file_t &) = delete;
+  mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+  std::string_view data;
+  int error = 0;
+};
+
+// Written next to the golden file and renamed over it, a reader never sees half of a snapshot
+static bool update_golden(const char *path, std::string_view actual) {
+  uncounted_scope_t uncounted;
+  static std::atomic<uint64_t> tmp_counter{0};
+  std::string tmp_path = std::string(path) + ".tmp." + std::to_string(getpid()) + "." + std::to_string(tmp_counter++);
+  std::FILE *file = std::fopen(tmp_path.c_str(), "w");
+  if (!file) {
+    output_printf("[\e[31mGOLDEN\e[39m] : %s : %s\r\n", tmp_path.c_str(), std::strerror(errno));
+    return false;
+  }
+
+  bool written = std::fwrite(actual.data(), 1, actual.size(), file) == actual.size();
+  if (std::fclose(file) || !written || std::rename(tmp_path.c_str(), path)) {
+    output_printf("[\e[31mGOLDEN\e[39m] : %s : %s\r\n", path, std::strerror(errno));
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  output_printf("[\e[33mGOLDEN\e[39m] : updated %s (%lu bytes)\r\n", path, actual.size());
+  return true;
+}
+
+static constexpr int golden_context_lines = 2;
+static constexpr int golden_diff_lines = 3;
+static constexpr size_t golden_line_width = 160;
+
+static size_t line_begin(std::string_view text, size_t pos) {
+  size_t newline = pos ? text.rfind('\n', pos - 1) : std::string_view::npos;
+  return newline == std::string_view::npos ? 0 : newline + 1;
+}
+
+static void print_golden_line(const char *prefix, size_t line_number, std::string_view line) {
+  std::string escaped;
+  for (size_t i = 0; i < line.size() && escaped.size() < golden_line_width; i++) {
+    unsigned char c = line[i];
+    if (std::isprint(c) || c == '\t') {
+      escaped += char(c);
+    } else {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "\\x%02x", c);
+      escaped += hex;
+    }
+  }
+  output_printf("\t%s%6lu | %s%s\r\n", prefix, line_number, escaped.c_str(),
+                line.size() > golden_line_width ? " ..." : "");
+}
+
+// Prints up to count lines starting at pos and returns where the next line starts
+static size_t print_golden_lines(const char *prefix, std::string_view text, size_t pos, size_t line_number,
+                                 int count) {
+  for (int i = 0; i < count && pos < text.size(); i++, line_number++) {
+    size_t end = text.find('\n', pos);
+    end = end == std::string_view::npos ? text.size() : end;
+    print_golden_line(prefix, line_number, text.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return pos;
+}
+
+// Like git, a NUL in the first 8000 bytes makes the content binary
+static bool is_binary(std::string_view data) { return data.substr(0, 8000).find('\0') != std::string_view::npos; }
+
+// A bounded unified diff of the lines around the first divergence, or a hex window for binary content
+static void print_golden_diff(const assert_site_t *site, std::string_view golden, std::string_view actual,
+                              size_t index) {
+  if (is_binary(golden) || is_binary(actual)) {
+    print_mismatch(index, golden.size(), actual.size());
+    print_bytes_window("golden", reinterpret_cast<const unsigned char *>(golden.data()), golden.size(), index, false);
+    print_bytes_window(site->exp1_str, reinterpret_cast<const unsigned char *>(actual.data()), actual.size(), index,
+                       false);
+    return;
+  }
+
+  size_t diff_begin = line_begin(golden, index);
+  size_t line_number = 1 + std::count(golden.begin(), golden.begin() + diff_begin, '\n');
+  size_t context_begin = diff_begin;
+  size_t context_number = line_number;
+  for (int i = 0; i < golden_context_lines && context_begin > 0; i++, context_number--)
+    context_begin = line_begin(golden, context_begin - 1);
+
+  output_printf("\tFirst difference at line %lu, column %lu (golden %lu bytes, %s %lu bytes)\r\n", line_number,
+                index - diff_begin + 1, golden.size(), site->exp1_str, actual.size());
+  print_golden_lines(" ", golden, context_begin, context_number, int(line_number - context_number));
+  print_golden_lines("-", golden, diff_begin, line_number, golden_diff_lines);
+  print_golden_lines("+", actual, diff_begin, line_number, golden_diff_lines);
+}
+
+[[gnu::cold, gnu::noinline]] static bool check_golden_failed(const assert_site_t *site, std::string_view golden,
+                                                             std::string_view actual, size_t index) {
+  uncounted_scope_t uncounted;
+  if (running_case() != no_case) {
+    print_check(site, false);
+    print_golden_diff(site, golden, actual, index);
+  }
+  return check_failed(site);
+}
+
+[[gnu::cold, gnu::noinline]] static bool check_golden_missing(const assert_site_t *site, const char *path, int error) {
+  uncounted_scope_t uncounted;
+  if (running_case() != no_case) {
+    print_check(site, false);
+    output_printf("\tCannot map golden file %s (%s), run with --update-golden to create it\r\n", path,
+                  std::strerror(error));
+  }
+  return check_failed(site);
+}
+
+bool check_golden(std::string_view actual, const char *path, const assert_site_t *site) {
+  mapped_file_t golden(path);
+  if (golden.error && !(opts.update_golden && golden.error == ENOENT))
+    return check_golden_missing(site, path, golden.error);
+
+  size_t size = std::min(golden.data.size(), actual.size());
+  size_t index = mismatch_bytes(golden.data.data(), actual.data(), size);
+  bool equal = !golden.error && index == size && golden.data.size() == actual.size();
+  if (__builtin_expect(equal, 1))
+    return check_passed(site);
+
+  // An updated snapshot is a pass, only a failed write is reported
+  if (opts.update_golden)
+    return update_golden(path, actual) ? check_passed(site) : check_failed(site);
+  return check_golden_failed(site, golden.data, actual, index);
+}
+
+static void print_benchmarks(void) {
+  if (benchmark_results.empty())
+    return;
+
+  std::printf("[\e[33mBENCHMARKS\e[39m] :\r\n");
+  for (const benchmark_result_t &result : benchmark_results) {
+    std::printf("\t\e[33m%s.%s\e[39m : %12.3f ns/op +- %.3f (MAD), 95%% CI [%.3f, %.3f], %lu iterations x %lu "
+                "samples, %lu outliers rejected\r\n",
+                result.benchmark->ts_name, result.benchmark->bm_name, result.ns_per_op, result.mad_ns_per_op,
+                result.ci_low_ns_per_op, result.ci_high_ns_per_op, result.iterations, result.samples, result.outliers);
+    if (opts.perf_counters && perf_available) {
+      std::printf("\t\t");
+      for (int i = 0; i < perf_events_num; i++)
+        if (perf_available & (1u << i))
+          std::printf("%s%.2f %s", i ? ", " : "", result.perf_per_op[i], perf_event_names[i]);
+      std::printf(" per op\r\n");
+    }
+    if (result.baseline_ns_per_op > 0)
+      std::printf("\t\t%s baseline %.3f ns/op (%+.1f%%)\r\n",
+                  result.regressed ? "[\e[31mREGRESSION\e[39m] against" : "[\e[32mOK\e[39m] against",
+                  result.baseline_ns_per_op, (result.ns_per_op / result.baseline_ns_per_op - 1) * 100);
+  }
+  std::printf("\r\n");
+}
+
+static void print_slowest(void) {
+  struct timing_t {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    std::string name;
+  };
+
+  std::vector<timing_t> cases, suites;
+  for (case_id_t id = 0; id < report.cases.size(); id++) {
+    const case_info_t &info = report.cases[id];
+    const testcase_report_t &tc_report = report.testcases[id];
+    if (!tc_report.ran)
+      continue;
+
+    if (suites.empty() || suites.back().name != info.ts_name)
+      suites.push_back(timing_t{0, 0, info.ts_name});
+    cases.push_back(timing_t{tc_report.wall_ns, tc_report.cpu_ns, full_name(info.ts_name, info.tc_name)});
+    suites.back().wall_ns += tc_report.wall_ns;
+    suites.back().cpu_ns += tc_report.cpu_ns;
+  }
+
+  auto print_top = [](std::vector<timing_t> &timings, const char *what) -> void {
+    size_t num = std::min<size_t>(opts.slowest_num, timings.size());
+    std::partial_sort(timings.begin(), timings.begin() + num, timings.end(),
+                      [](const timing_t &a, const timing_t &b) -> bool { return a.wall_ns > b.wall_ns; });
+    std::printf("\tSlowest %s :\r\n", what);
+    for (size_t i = 0; i < num; i++)
+      std::printf("\t\t%8.3f ms (cpu %8.3f ms) \e[33m%s\e[39m\r\n", timings[i].wall_ns / 1e6, timings[i].cpu_ns / 1e6,
+                  timings[i].name.c_str());
+    std::printf("\r\n");
+  };
+
+  std::printf("[\e[33mTIMING\e[39m] : run took %.3f ms\r\n", run_wall_ns / 1e6);
+  if (opts.slowest_num > 0) {
+    print_top(cases, "testcases");
+    print_top(suites, "testsuites");
+  }
+}
 
-      ts_pass_count += tc_pass_count;
-      ts_fails_count += tc_fails_count;
-      std::printf("\r\n");
-      std::printf("\t\t\tTotal passed - \e[32m%lu\e[39m, failed - "
-                  "\e[31m%lu\e[39m in \"\e[33m%s\e[39m\" testcase\r\n",
-                  tc_pass_count, tc_fails_count, testcase_info.first.c_str());
-      std::printf("\r\n");
+static void print_allocations(void) {
+  uint64_t allocations = 0, bytes = 0, chunks = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const std::unique_ptr<results_buffer_t> &results : results_buffers()) {
+      allocations += results->arena.allocations;
+      bytes += results->arena.bytes;
+      chunks += results->arena.chunks;
     }
+  }
+
+  std::printf("[\e[33mALLOCATIONS\e[39m] : framework made %lu allocations (%.1f KiB) from %lu arena chunks in %zu "
+              "threads\r\n\r\n",
+              allocations, bytes / 1024.0, chunks, results_buffers().size());
+}
+
+// One JSON object per line: a header for the shard, then one line per testcase, so shards can be concatenated
+static void save_shard_summary(const char *path) {
+  std::FILE *file = std::fopen(path, "w");
+  if (!file) {
+    std::perror(path);
+    return;
+  }
+
+  std::vector<std::string> lines;
+  uint64_t pass_count = 0;
+  uint64_t fails_count = 0;
+  for (case_id_t id = 0; id < report.cases.size(); id++) {
+    const testcase_report_t &tc_report = report.testcases[id];
+    if (!tc_report.ran)
+      continue;
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"shard\":%i,\"suite\":\"%s\",\"case\":\"%s\",\"passed\":%lu,\"failed\":%lu,"
+                  "\"wall_ns\":%lu,\"cpu_ns\":%lu}\n",
+                  opts.shard_index, report.cases[id].ts_name, report.cases[id].tc_name, tc_report.passed,
+                  tc_report.failed, tc_report.wall_ns, tc_report.cpu_ns);
+    lines.push_back(line);
+    pass_count += tc_report.passed;
+    fails_count += tc_report.failed;
+  }
+
+  pass_count += report.outside.passed;
+  fails_count += report.outside.failed;
+  std::fprintf(file,
+               "{\"shard\":%i,\"shards\":%i,\"testcases\":%zu,\"passed\":%lu,\"failed\":%lu,\"wall_ns\":%lu}\n",
+               opts.shard_index, std::max(opts.shard_count, 1), lines.size(), pass_count, fails_count, run_wall_ns);
+  for (const std::string &line : lines)
+    std::fputs(line.c_str(), file);
+  std::fclose(file);
+}
+
+static void print_perf_counters(const uint64_t *perf) {
+  std::printf("\t\t\t");
+  for (int i = 0; i < perf_events_num; i++) {
+    if (perf_available & (1u << i))
+      std::printf("%s%lu %s", i ? ", " : "", perf[i], perf_event_names[i]);
+    else
+      std::printf("%sn/a %s", i ? ", " : "", perf_event_names[i]);
+  }
+  if ((perf_available & 3) == 3 && perf[0])
+    std::printf(" (IPC %.2f)", double(perf[1]) / perf[0]);
+  std::printf("\r\n");
+}
+
+void print_results(void) {
+  merge_results();
+  std::printf("\r\n[\e[33mSUMMARY\e[39m] :\r\n");
 
+  uint64_t ts_pass_count = 0;
+  uint64_t ts_fails_count = 0;
+  uint64_t ts_wall_ns = 0;
+  uint64_t ts_cpu_ns = 0;
+  const char *ts = nullptr;
+  auto print_testsuite_total = [&]() -> void {
     std::printf("\t\tTotal passed - \e[32m%lu\e[39m, failed - \e[31m%lu\e[39m "
-                "in \"\e[33m%s\e[39m\" testsuite\r\n",
-                ts_pass_count, ts_fails_count, testsuite_info.first.c_str());
+                "in \"\e[33m%s\e[39m\" testsuite, took %.3f ms (cpu %.3f ms)\r\n",
+                ts_pass_count, ts_fails_count, ts, ts_wall_ns / 1e6, ts_cpu_ns / 1e6);
     std::printf("\r\n\r\n");
+    ts_pass_count = ts_fails_count = ts_wall_ns = ts_cpu_ns = 0;
+  };
+  auto print_checks = [](uint64_t bucket) -> void {
+    for (uint64_t i = report.checks_begin[bucket]; i < report.checks_begin[bucket + 1]; i++) {
+      const test_info_t &check_info = report.checks[i];
+      if (check_info.ok) {
+        if (opts.verbose_level > 0)
+          std::printf("\t\t\t[\e[32mOK\e[39m] (%s), ( \e[33m%s\e[39m, \e[33m%s\e[39m )\r\n", op_name(check_info.site),
+                      check_info.site->exp1_str, check_info.site->exp2_str);
+      } else {
+        std::printf("\t\t\t[\e[31mFAIL\e[39m] (%s), ( \e[33m%s\e[39m, \e[33m%s\e[39m )\r\n", op_name(check_info.site),
+                    check_info.site->exp1_str, check_info.site->exp2_str);
+      }
+    }
+  };
+
+  // Suites are contiguous ID ranges and the checks are grouped by case, so this is one linear pass
+  for (case_id_t id = 0; id < report.cases.size(); id++) {
+    const case_info_t &info = report.cases[id];
+    const testcase_report_t &tc_report = report.testcases[id];
+    if (!tc_report.ran)
+      continue;
+
+    if (ts != info.ts_name) {
+      if (ts)
+        print_testsuite_total();
+      ts = info.ts_name;
+      std::printf("\tIn testsuite [\e[33m%s\e[39m] :\r\n", ts);
+    }
+
+    std::printf("\t\tIn testcase [\e[33m%s\e[39m] :\r\n", info.tc_name);
+    print_checks(id);
+
+    ts_pass_count += tc_report.passed;
+    ts_fails_count += tc_report.failed;
+    ts_wall_ns += tc_report.wall_ns;
+    ts_cpu_ns += tc_report.cpu_ns;
+    std::printf("\r\n");
+    std::printf("\t\t\tTotal passed - \e[32m%lu\e[39m, failed - "
+                "\e[31m%lu\e[39m in \"\e[33m%s\e[39m\" testcase, took %.3f ms (cpu %.3f ms)\r\n",
+                tc_report.passed, tc_report.failed, info.tc_name, tc_report.wall_ns / 1e6, tc_report.cpu_ns / 1e6);
+    if (opts.perf_counters && perf_available)
+      print_perf_counters(tc_report.perf);
+#ifdef TEST_COUNT_ALLOCS
+    std::printf("\t\t\tAllocated %lu times (%lu bytes), %s%lu bytes outstanding\e[39m at the end of the testcase\r\n",
+                tc_report.allocations, tc_report.alloc_bytes, tc_report.outstanding_bytes ? "\e[31m" : "\e[32m",
+                tc_report.outstanding_bytes);
+#endif
+    std::printf("\r\n");
+  }
+
+  if (ts)
+    print_testsuite_total();
+
+  // Checks made before, after or beside the testcases, e.g. by a helper thread no case could be found for
+  const testcase_report_t &outside = report.outside;
+  if (outside.passed || outside.failed) {
+    std::printf("\tOutside of testcases :\r\n");
+    print_checks(report.cases.size());
+    std::printf("\r\n\t\tTotal passed - \e[32m%lu\e[39m, failed - \e[31m%lu\e[39m outside of testcases\r\n\r\n\r\n",
+                outside.passed, outside.failed);
   }
+
+  print_benchmarks();
+  print_slowest();
+  print_allocations();
+  if (opts.perf_counters && perf_available != (1u << perf_events_num) - 1)
+    std::printf("[\e[33mPERF\e[39m] : %s hardware counters are unavailable (%s), check "
+                "/proc/sys/kernel/perf_event_paranoid or the container's seccomp profile\r\n\r\n",
+                perf_available ? "some" : "the", std::strerror(perf_errno));
+  if (opts.shard_summary)
+    save_shard_summary(opts.shard_summary);
+  if (opts.timing_cache)
+    save_timing_cache(opts.timing_cache);
 }
 } // namespace test
 
 void usage(void) {
-  std::printf("Usage : %s [opts]\r\n\t-v [-vv] : Verbosity level (default is "
-              "0).\r\n\t-t [digit] : Number of threads (default is "
-              "1).\r\n\r\n\tExample : %s -v -t $(nproc)\r\n",
+  std::printf("Usage : %s [opts]\r\n"
+              "\t-v [-vv] : Verbosity level (default is 0).\r\n"
+              "\t-t [digit] : Number of threads (default is 1).\r\n"
+              "\t-s : Static slice partitioning instead of work stealing.\r\n"
+              "\t-f : Only count passing checks, records are kept for failures and at -vv.\r\n"
+              "\t-j [digit] : Run every case in a pool of pre-forked worker processes.\r\n"
+              "\t--filter=[patterns] : Only run Suite.Name matching the ':'-separated globs, globs after '-' "
+              "exclude (e.g. Suite.*:-Suite.Slow).\r\n"
+              "\t--shard-index=[digit], --shard-count=[digit] : Only run the cases hashed to this shard.\r\n"
+              "\t--shard-summary=[path] : Write a JSON lines summary of this shard.\r\n"
+              "\t--timing-cache=[path] : Schedule longest cases first from the durations of previous runs.\r\n"
+              "\t--output=junit:[path], --output=json:[path] : Stream a JUnit XML or JSON lines report of the "
+              "testcases.\r\n"
+              "\t--perf : Capture cycles, instructions, cache and branch misses of every testcase and benchmark.\r\n"
+              "\t--update-golden : Rewrite the golden files that EXPECT_MATCHES_GOLDEN finds different or missing.\r\n"
+              "\t--self-benchmark : Report the rough code size and time of a check built with the framework's "
+              "flags, then exit.\r\n"
+              "\t-l, --list : List the selected testcases and benchmarks without running them.\r\n"
+              "\t-T, --slowest=[digit] : Number of slowest testcases and testsuites to list (default is 10).\r\n"
+              "\t-b, --benchmarks : Run the benchmarks after the tests.\r\n"
+              "\t--benchmark-sample-ms=[digit] : Target duration of one benchmark sample (default is 20).\r\n"
+              "\t--benchmark-samples=[digit] : Number of samples per benchmark (default is 15).\r\n"
+              "\t--benchmark-baseline=[path] : Compare the benchmarks against a saved baseline.\r\n"
+              "\t--benchmark-threshold=[percent] : Slowdown reported as a failure (default is 5).\r\n"
+              "\t--benchmark-save=[path] : Save the benchmark results as a baseline.\r\n"
+              "\r\n\tExample : %s -v -t $(nproc)\r\n",
               progname, progname);
   std::exit(0);
 }
 
 int main(int argc, char *argv[]) {
-  static const char *opt_str = "t:vh?";
+  static const char *opt_str = "t:sfj:lT:bvh?";
+  static const option long_opts[] = {
+      {"filter", required_argument, nullptr, 'F'},
+      {"list", no_argument, nullptr, 'l'},
+      {"shard-index", required_argument, nullptr, 'I'},
+      {"shard-count", required_argument, nullptr, 'C'},
+      {"shard-summary", required_argument, nullptr, 'Y'},
+      {"timing-cache", required_argument, nullptr, 'D'},
+      {"output", required_argument, nullptr, 'O'},
+      {"perf", no_argument, nullptr, 'P'},
+      {"self-benchmark", no_argument, nullptr, 'X'},
+      {"update-golden", no_argument, nullptr, 'G'},
+      {"slowest", required_argument, nullptr, 'T'},
+      {"benchmarks", no_argument, nullptr, 'b'},
+      {"benchmark-sample-ms", required_argument, nullptr, 'B'},
+      {"benchmark-samples", required_argument, nullptr, 'N'},
+      {"benchmark-baseline", required_argument, nullptr, 'L'},
+      {"benchmark-threshold", required_argument, nullptr, 'R'},
+      {"benchmark-save", required_argument, nullptr, 'S'},
+      {nullptr, 0, nullptr, 0},
+  };
   progname = argv[0];
-  int opt = getopt(argc, argv, opt_str);
+  int opt = getopt_long(argc, argv, opt_str, long_opts, nullptr);
 
   while (opt != -1) {
     switch (opt) {
@@ -340,6 +2449,91 @@ int main(int argc, char *argv[]) {
       opts.threads_num = atoi(optarg);
       break;
 
+    case 's':
+      opts.static_schedule = true;
+      break;
+
+    case 'f':
+      opts.fast_pass = true;
+      break;
+
+    case 'j':
+      opts.isolated_workers = atoi(optarg);
+      break;
+
+    case 'F':
+      opts.filter = optarg;
+      break;
+
+    case 'I':
+      opts.shard_index = atoi(optarg);
+      break;
+
+    case 'C':
+      opts.shard_count = atoi(optarg);
+      break;
+
+    case 'Y':
+      opts.shard_summary = optarg;
+      break;
+
+    case 'D':
+      opts.timing_cache = optarg;
+      break;
+
+    case 'O':
+      if (!std::strncmp(optarg, "junit:", 6))
+        opts.output_junit = optarg + 6;
+      else if (!std::strncmp(optarg, "json:", 5))
+        opts.output_json = optarg + 5;
+      else
+        usage();
+      break;
+
+    case 'P':
+      opts.perf_counters = true;
+      break;
+
+    case 'X':
+      opts.self_benchmark = true;
+      break;
+
+    case 'G':
+      opts.update_golden = true;
+      break;
+
+    case 'l':
+      opts.list = true;
+      break;
+
+    case 'T':
+      opts.slowest_num = atoi(optarg);
+      break;
+
+    case 'b':
+      opts.run_benchmarks = true;
+      break;
+
+    case 'B':
+      opts.benchmark_sample_ms = atoi(optarg);
+      break;
+
+    case 'N':
+      opts.benchmark_samples = atoi(optarg);
+      break;
+
+    case 'L':
+      opts.benchmark_baseline = optarg;
+      break;
+
+    case 'R':
+      opts.benchmark_threshold = atof(optarg);
+      break;
+
+    case 'S':
+      opts.benchmark_save = optarg;
+      break;
+
     case 'v':
       opts.verbose_level++;
       break;
@@ -353,10 +2547,31 @@ int main(int argc, char *argv[]) {
       break;
     }
 
-    opt = getopt(argc, argv, opt_str);
+    opt = getopt_long(argc, argv, opt_str, long_opts, nullptr);
+  }
+
+  if (opts.shard_count < 1 || opts.shard_index < 0 || opts.shard_index >= opts.shard_count) {
+    std::fprintf(stderr, "%s : --shard-index must be in [0, --shard-count)\r\n", progname);
+    return 1;
+  }
+
+  if (opts.list) {
+    test::list_testcases();
+    return 0;
+  }
+
+  if (opts.self_benchmark) {
+    test::self_benchmark();
+    return 0;
   }
 
+  test::open_reports();
   test::run_tests();
+  if (opts.run_benchmarks)
+    test::run_benchmarks();
+  test::merge_results();
+  test::stream_outside_checks();
+  test::close_reports();
   test::print_results();
   return 0;
 }
@@ -2,28 +2,63 @@
 #define TEST_HPP
 
 #include <algorithm>
-#include <condition_variable>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <memory_resource>
 #include <mutex>
+#include <limits>
+#include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <thread>
 #include <tuple>
 #include <vector>
 
 namespace test {
 using success_t = bool;
-using test_suite_name_t = std::string;
-using test_case_name_t = std::string;
-using location_t = std::string;
-using expression_t = std::string;
 using assert_number_t = uint64_t;
-using test_info_t =
-    std::tuple<assert_number_t, success_t, test_suite_name_t, test_case_name_t, location_t, expression_t, expression_t>;
+using case_id_t = uint32_t;
+
+// Checks made outside of any testcase
+static constexpr case_id_t no_case = ~case_id_t(0);
+
+enum class assert_op_t : uint8_t {
+  equal,
+  not_equal,
+  str_equal,
+  not_str_equal,
+  crash,
+  regression,
+  max_allocs,
+  range_equal,
+  bytes_equal,
+  array_near,
+  array_ulp,
+  matches_golden
+};
+
+struct assert_site_t {
+  const char *file;
+  int line;
+  assert_op_t op;
+  bool fatal;
+  const char *exp1_str;
+  const char *exp2_str;
+  const char *comment;
+};
+
+struct test_info_t {
+  assert_number_t number;
+  const assert_site_t *site;
+  case_id_t case_id;
+  success_t ok;
+};
 
 template <typename S, typename T> struct is_streamable {
 private:
@@ -42,48 +77,333 @@ extern std::string demangle_typestr(const char *name);
 struct opts_t {
   int verbose_level = 0;
   int threads_num = 0;
+  bool static_schedule = false;
+  int isolated_workers = 0;
+  int slowest_num = 10;
+  const char *filter = nullptr;
+  bool list = false;
+  int shard_index = 0;
+  int shard_count = 1;
+  const char *shard_summary = nullptr;
+  const char *timing_cache = nullptr;
+  const char *output_junit = nullptr;
+  const char *output_json = nullptr;
+  bool perf_counters = false;
+  bool self_benchmark = false;
+  bool update_golden = false;
+  bool run_benchmarks = false;
+  int benchmark_sample_ms = 20;
+  int benchmark_samples = 15;
+  double benchmark_threshold = 5.0;
+  const char *benchmark_baseline = nullptr;
+  const char *benchmark_save = nullptr;
+#ifdef TEST_FAST_PASS
+  bool fast_pass = true;
+#else
+  bool fast_pass = false;
+#endif
 };
 
 extern opts_t opts;
 
 namespace test {
+// Hardware counters captured with --perf: cycles, instructions, cache misses and branch misses
+static constexpr int perf_events_num = 4;
+
+struct testcase_t {
+  const char *ts_name;
+  const char *tc_name;
+  const char *file;
+  int line;
+  void (*fn)(const testcase_t &tc);
+  case_id_t id;
+
+  // Set by TEST_P and TYPED_TEST, the descriptor is then expanded into instances Case/0 .. Case/N-1
+  size_t (*instances)(void);
+  uint32_t instance;
+};
+
+using task_t = const testcase_t *;
+
+struct benchmark_t {
+  const char *ts_name;
+  const char *bm_name;
+  void (*fn)(void);
+  case_id_t id;
+};
+
+struct benchmark_result_t {
+  const benchmark_t *benchmark;
+  uint64_t iterations;
+  uint64_t samples;
+  uint64_t outliers;
+  double ns_per_op;
+  double mad_ns_per_op;
+  double ci_low_ns_per_op;
+  double ci_high_ns_per_op;
+  double min_ns_per_op;
+  double max_ns_per_op;
+  double baseline_ns_per_op;
+  double perf_per_op[perf_events_num];
+  bool regressed;
+};
+
+extern std::vector<benchmark_result_t> benchmark_results;
+
+template <typename T> inline void do_not_optimize(const T &value) { asm volatile("" : : "r,m"(value) : "memory"); }
+inline void clobber_memory() { asm volatile("" : : : "memory"); }
+
+std::vector<task_t> select_testcases(void);
+void list_testcases(void);
 void run_tests(void);
-bool assert_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                      const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name);
-bool assert_not_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                          const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name);
-bool expect_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                      const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name);
-bool expect_not_str_equal(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                          const char *exp2_str, const std::string *p_ts_name, const std::string *p_tc_name);
-bool assert_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                              const char *exp2_str);
-bool assert_not_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                                  const char *exp2_str);
-bool expect_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                              const char *exp2_str);
-bool expect_not_str_equal_builtin(const char *exp1, const char *exp2, const char *file, int line, const char *exp1_str,
-                                  const char *exp2_str);
+void run_benchmarks(void);
+void self_benchmark(void);
+bool assert_str_equal(const char *exp1, const char *exp2, const assert_site_t *site);
+bool assert_not_str_equal(const char *exp1, const char *exp2, const assert_site_t *site);
+bool expect_str_equal(const char *exp1, const char *exp2, const assert_site_t *site);
+bool expect_not_str_equal(const char *exp1, const char *exp2, const assert_site_t *site);
+bool assert_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site);
+bool assert_not_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site);
+bool expect_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site);
+bool expect_not_str_equal(std::string_view exp1, std::string_view exp2, const assert_site_t *site);
+bool check_bytes_equal(const void *exp1, const void *exp2, size_t size, const assert_site_t *site);
+bool check_golden(std::string_view actual, const char *path, const assert_site_t *site);
 void print_results(void);
+void open_reports(void);
+void stream_outside_checks(void);
+void close_reports(void);
+
+struct case_info_t {
+  const char *ts_name;
+  const char *tc_name;
+  uint32_t suite_id;
+};
 
-static std::function<std::pair<std::string *, std::string *>(void)> *resolv_ts_tc_names = nullptr;
-static std::condition_variable sync_var;
-static bool notified = true;
+struct testcase_report_t {
+  uint64_t passed = 0;
+  uint64_t failed = 0;
+  uint64_t fast_passes = 0;
+  uint64_t wall_ns = 0;
+  uint64_t cpu_ns = 0;
+  uint64_t allocations = 0;
+  uint64_t alloc_bytes = 0;
+  uint64_t outstanding_bytes = 0;
+  uint64_t perf[perf_events_num] = {};
+  bool ran = false;
+};
+
+// Testcases and benchmarks get dense IDs at registration, sorted by suite and name so that every suite is a
+// contiguous ID range. All per-case data lives in flat vectors indexed by those IDs, checks made outside of any
+// testcase are counted in outside and sorted after the last case.
+struct report_t {
+  std::vector<const char *> suites;
+  std::vector<case_info_t> cases;
+  std::vector<testcase_report_t> testcases;
+  testcase_report_t outside;
+  std::vector<test_info_t> checks;
+  std::vector<uint64_t> checks_begin;
+};
 
-extern std::map<std::string,
-                std::map<std::string, std::vector<std::tuple<bool, std::string, std::string, std::string>>>>
-    report;
-extern std::vector<test::test_info_t> test_results;
+struct testcase_entry_t {
+  case_id_t case_id = no_case;
+  uint64_t fast_passes;
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+  uint64_t records;
+  uint64_t allocations = 0;
+  uint64_t alloc_bytes = 0;
+  uint64_t outstanding_bytes = 0;
+  uint64_t perf[perf_events_num] = {};
+};
+
+// Monotonic per-thread arena for the framework's own bookkeeping. Chunks come straight from mmap, so the code
+// under test never shares malloc arenas with the framework, and everything is unmapped in one go at exit.
+class arena_t : public std::pmr::memory_resource {
+public:
+  static constexpr size_t chunk_size = 1 << 20;
+
+  arena_t() = default;
+  arena_t(const arena_t &) = delete;
+  arena_t &operator=(const arena_t &) = delete;
+  ~arena_t();
+
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  uint64_t chunks = 0;
+
+private:
+  struct chunk_t {
+    chunk_t *next;
+    size_t size;
+  };
+
+  chunk_t *head = nullptr;
+  char *pos = nullptr;
+  char *end = nullptr;
+
+  void *do_allocate(size_t size, size_t alignment) override;
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+struct alignas(64) results_buffer_t {
+  arena_t arena;
+  std::pmr::vector<test_info_t> test_results{&arena};
+  std::pmr::vector<testcase_entry_t> testcases{&arena};
+  uint64_t asserts_counter = 0;
+  uint64_t fast_passes = 0;
+  uint64_t fast_passes_mark = 0;
+  uint64_t records_mark = 0;
+  uint64_t wall_mark = 0;
+  uint64_t cpu_mark = 0;
+  std::pmr::string output{&arena};
+  bool perf_opened = false;
+  int perf_fds[perf_events_num];
+  uint64_t perf_mark[perf_events_num];
+};
+
+extern report_t report;
 extern std::mutex mtx;
 extern uint64_t asserts_counter;
-extern thread_local std::string ts_name, tc_name;
-extern bool stub_res;
+extern thread_local case_id_t current_case;
+extern thread_local bool in_testcase;
+extern thread_local results_buffer_t *p_local_results;
+
+// Number of running testcases in the high half, the case when it runs alone in the low half
+extern std::atomic<uint64_t> running_cases;
+
+// The case a check belongs to: the one this thread runs or, on a thread started by a testcase body, the only
+// running case. With several cases in flight such a thread names its case with case_scope_t
+inline case_id_t running_case() {
+  return current_case != no_case ? current_case : case_id_t(running_cases.load(std::memory_order_relaxed));
+}
+
+class case_scope_t {
+public:
+  explicit case_scope_t(case_id_t id) : saved(current_case) { current_case = id; }
+  ~case_scope_t() { current_case = saved; }
+  case_scope_t(const case_scope_t &) = delete;
+  case_scope_t &operator=(const case_scope_t &) = delete;
+
+private:
+  case_id_t saved;
+};
+
+results_buffer_t *register_local_results(void);
+void register_testcases(void);
+void merge_results(void);
+
+inline results_buffer_t &local_results() {
+  if (!p_local_results)
+    p_local_results = register_local_results();
+  return *p_local_results;
+}
+
+void output_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void output_write(const std::string &str);
+void flush_output(void);
+
+void begin_testcase(case_id_t id);
+void end_testcase(void);
+void register_fixture_teardown(void (*teardown)(void));
+void teardown_fixtures(void);
+
+#ifdef TEST_COUNT_ALLOCS
+struct alloc_counters_t {
+  bool active;
+  uint64_t epoch;
+  uint64_t allocations;
+  uint64_t bytes;
+  uint64_t freed_bytes;
+};
+
+// Counts operator new calls of the running testcase on this thread. Every allocation is tagged with the epoch of
+// the case that made it, so only frees of the case's own allocations are subtracted
+extern thread_local alloc_counters_t alloc_counters;
+
+// Framework work inside a testcase (printing, reporting, fixture setup) is not charged to the case
+class uncounted_scope_t {
+public:
+  uncounted_scope_t() : active(alloc_counters.active) { alloc_counters.active = false; }
+  ~uncounted_scope_t() { alloc_counters.active = active; }
+
+private:
+  bool active;
+};
+#else
+class uncounted_scope_t {
+public:
+  uncounted_scope_t() {}
+};
+#endif
+
+// One instance per fixture type, built by the first case of any thread that needs it and shared read-only by all
+// cases of the suite. It is destroyed after the run, in reverse order of construction.
+template <typename F> class fixture_holder_t {
+public:
+  static const F &get() {
+    std::call_once(flag, [] {
+      // Built by whichever case gets here first, its setup must not be charged to that case
+      uncounted_scope_t uncounted;
+      instance = new F();
+      register_fixture_teardown(destroy);
+    });
+    return *instance;
+  }
+
+private:
+  static void destroy() {
+    delete instance;
+    instance = nullptr;
+  }
+
+  static inline std::once_flag flag;
+  static inline F *instance = nullptr;
+};
+
+const char *op_name(const assert_site_t *site);
+void print_check(const assert_site_t *site, bool ok);
+
+// The inline part of a check is the compare, a branch and the fast pass counter, everything else is outlined. Recorded
+// passes go through record_pass, failures and exceptions through the cold functions below, which end up in
+// .text.unlikely
+bool record_pass(const assert_site_t *site);
+[[gnu::cold]] bool check_failed(const assert_site_t *site);
+[[gnu::cold]] bool record_exception(const assert_site_t *site, const std::exception &e);
+
+inline bool fast_pass() { return opts.fast_pass && opts.verbose_level < 2; }
+
+inline bool check_passed(const assert_site_t *site) {
+  if (fast_pass()) {
+    local_results().fast_passes++;
+    return true;
+  }
+  return record_pass(site);
+}
+
+struct shared_ring_t;
+extern shared_ring_t *p_shared_ring;
+void push_shared_record(const test_info_t &record);
+void push_foreign_record(const test_info_t &record);
+
+inline bool record_result(const assert_site_t *site, bool ok) {
+  results_buffer_t &results = local_results();
+  test_info_t record{results.asserts_counter++, site, running_case(), ok};
+  if (p_shared_ring)
+    push_shared_record(record);
+  else if (!in_testcase && record.case_id != no_case)
+    push_foreign_record(record);
+  else
+    results.test_results.push_back(record);
+  return ok;
+}
 
 template <typename T> decltype(auto) print_value(const T &t) {
   if constexpr (!std::is_null_pointer_v<T>) {
     if constexpr (is_streamable_v<std::ostream, T>) {
 
-      return t;
+      // (t) makes decltype(auto) a reference, the value is never copied
+      return (t);
     } else {
 
       size_t num_bytes = sizeof(T);
@@ -98,569 +418,369 @@ template <typename T> decltype(auto) print_value(const T &t) {
 
 template <typename A, typename B> void print_values(const A &a, const B &b) {
   if (opts.verbose_level > 1) {
-    std::cout << "( \"" << print_value(a) << "\", \"" << print_value(b) << "\" )" << std::endl << std::endl;
+    uncounted_scope_t uncounted;
+    std::ostringstream stream;
+    stream << "( \"" << print_value(a) << "\", \"" << print_value(b) << "\" )\n\n";
+    output_write(stream.str());
   }
 }
 
 template <typename A, typename B>
-bool assert_equal_builtin(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str) {
-  bool ok = (exp1 == exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  if (!ok)
-    std::terminate();
-  return ok;
+[[gnu::cold, gnu::noinline]] bool check_failed(const assert_site_t *site, const A &exp1, const B &exp2) {
+  if (running_case() != no_case) {
+    print_check(site, false);
+    print_values(exp1, exp2);
+  }
+  return check_failed(site);
 }
 
-template <typename A, typename B>
-bool assert_not_equal_builtin(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str) {
-  bool ok = (exp1 != exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  if (!ok)
-    std::terminate();
-  return ok;
+template <typename A, typename B> bool check_values(const assert_site_t *site, bool ok, const A &exp1, const B &exp2) {
+  if (__builtin_expect(ok, 1))
+    return check_passed(site);
+  return check_failed(site, exp1, exp2);
 }
 
-template <typename A, typename B>
-bool expect_equal_builtin(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str) {
-  bool ok = (exp1 == exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  return ok;
+// Fatality is carried by the call site, check_failed terminates for the ASSERT_ flavours
+template <typename A, typename B> bool assert_equal(A &&exp1, B &&exp2, const assert_site_t *site) {
+  return check_values(site, exp1 == exp2, exp1, exp2);
 }
 
-template <typename A, typename B>
-bool expect_not_equal_builtin(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str) {
-  bool ok = (exp1 != exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-  test_results.push_back(std::make_tuple(asserts_counter, ok, "none", "none",
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  asserts_counter++;
-  return ok;
+template <typename A, typename B> bool assert_not_equal(A &&exp1, B &&exp2, const assert_site_t *site) {
+  return check_values(site, exp1 != exp2, exp1, exp2);
 }
 
-template <typename A, typename B>
-bool assert_equal(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str,
-                  const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (exp1 == exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s == %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s != %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok)
-    print_values(exp1, exp2);
+template <typename A, typename B> bool expect_equal(A &&exp1, B &&exp2, const assert_site_t *site) {
+  return check_values(site, exp1 == exp2, exp1, exp2);
+}
 
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "ASSERT_EQ", exp1_str, exp2_str));
-  asserts_counter++;
+template <typename A, typename B> bool expect_not_equal(A &&exp1, B &&exp2, const assert_site_t *site) {
+  return check_values(site, exp1 != exp2, exp1, exp2);
+}
 
-  if (!ok)
-    std::terminate();
-  return ok;
+// Index of the first element that differs, or size. SSE2 or AVX2 kernels are picked at runtime when the CPU has them
+size_t mismatch_bytes(const void *exp1, const void *exp2, size_t size);
+size_t mismatch_near(const float *exp1, const float *exp2, size_t size, float tolerance);
+size_t mismatch_near(const double *exp1, const double *exp2, size_t size, double tolerance);
+size_t mismatch_ulp(const float *exp1, const float *exp2, size_t size, uint64_t max_ulps);
+size_t mismatch_ulp(const double *exp1, const double *exp2, size_t size, uint64_t max_ulps);
+
+[[gnu::cold]] void print_mismatch(size_t index, size_t size1, size_t size2);
+
+template <typename R, typename = void> struct is_contiguous_range : std::false_type {};
+template <typename R>
+struct is_contiguous_range<R, std::void_t<decltype(std::data(std::declval<R &>()))>> : std::true_type {};
+
+template <typename R>
+using range_value_t = std::remove_cv_t<std::remove_reference_t<decltype(*std::begin(std::declval<R &>()))>>;
+
+template <typename T> static constexpr bool is_simd_float_v = std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+static constexpr size_t mismatch_window = 4;
+
+template <typename R> void print_window(const char *name, const R &range, size_t size, size_t index) {
+  uncounted_scope_t uncounted;
+  using value_t = range_value_t<const R>;
+  size_t begin = index > mismatch_window ? index - mismatch_window : 0;
+  size_t end = std::min(size, index + mismatch_window + 1);
+  std::ostringstream stream;
+  if constexpr (std::is_floating_point_v<value_t>)
+    stream.precision(std::numeric_limits<value_t>::max_digits10);
+
+  stream << "\t" << name << "[" << begin << ".." << end << ") :";
+  auto it = std::next(std::begin(range), begin);
+  for (size_t i = begin; i < end; i++, ++it) {
+    stream << (i == index ? " [" : " ");
+    if constexpr (std::is_integral_v<value_t> && sizeof(value_t) == 1)
+      stream << +*it;
+    else
+      stream << print_value(*it);
+    stream << (i == index ? "]" : "");
+  }
+  stream << "\r\n";
+  output_write(stream.str());
 }
 
-template <typename A, typename B>
-bool assert_not_equal(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str,
-                      const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (exp1 != exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s != %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s == %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok)
-    print_values(exp1, exp2);
+template <typename R1, typename R2>
+[[gnu::cold, gnu::noinline]] bool check_range_failed(const assert_site_t *site, const R1 &r1, const R2 &r2,
+                                                     size_t index) {
+  if (running_case() != no_case) {
+    print_check(site, false);
+    print_mismatch(index, std::size(r1), std::size(r2));
+    print_window(site->exp1_str, r1, std::size(r1), index);
+    print_window(site->exp2_str, r2, std::size(r2), index);
+  }
+  return check_failed(site);
+}
 
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "ASSERT_NOT_EQ", exp1_str, exp2_str));
-  asserts_counter++;
+template <typename R1, typename R2> size_t range_mismatch(const R1 &r1, const R2 &r2, size_t size) {
+  using value_t = range_value_t<const R1>;
+  constexpr bool contiguous = is_contiguous_range<const R1>::value && is_contiguous_range<const R2>::value &&
+                              std::is_same_v<value_t, range_value_t<const R2>>;
+
+  // == on floats is IEEE equality (-0 == 0, NaN != NaN), the same as a zero tolerance
+  if constexpr (contiguous && is_simd_float_v<value_t>) {
+    return mismatch_near(std::data(r1), std::data(r2), size, value_t(0));
+  } else if constexpr (contiguous && (std::is_integral_v<value_t> || std::is_enum_v<value_t> ||
+                                      std::is_pointer_v<value_t>)) {
+    return mismatch_bytes(std::data(r1), std::data(r2), size * sizeof(value_t)) / sizeof(value_t);
+  } else {
+    size_t index = 0;
+    for (auto it1 = std::begin(r1), it2 = std::begin(r2); index < size && *it1 == *it2; ++it1, ++it2)
+      index++;
+    return index;
+  }
+}
 
-  if (!ok)
-    std::terminate();
-  return ok;
+template <typename R1, typename R2> bool check_range_equal(R1 &&r1, R2 &&r2, const assert_site_t *site) {
+  size_t size1 = std::size(r1), size2 = std::size(r2);
+  size_t index = range_mismatch(r1, r2, std::min(size1, size2));
+  if (__builtin_expect(index == size1 && size1 == size2, 1))
+    return check_passed(site);
+  return check_range_failed(site, r1, r2, index);
 }
 
-template <typename A, typename B>
-bool expect_equal(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str,
-                  const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (exp1 == exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s == %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s != %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok)
-    print_values(exp1, exp2);
+template <typename R1, typename R2> void check_float_arrays() {
+  static_assert(is_contiguous_range<R1>::value && is_contiguous_range<R2>::value,
+                "ARRAY_NEAR and ARRAY_ULP compare contiguous ranges");
+  static_assert(std::is_same_v<range_value_t<R1>, range_value_t<R2>> && is_simd_float_v<range_value_t<R1>>,
+                "ARRAY_NEAR and ARRAY_ULP compare ranges of the same floating point type, float or double");
+}
 
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "EXPECT_EQ", exp1_str, exp2_str));
-  asserts_counter++;
-  return ok;
+template <typename R1, typename R2, typename T>
+bool check_array_near(R1 &&r1, R2 &&r2, T tolerance, const assert_site_t *site) {
+  check_float_arrays<R1, R2>();
+  size_t size1 = std::size(r1), size2 = std::size(r2);
+  size_t index = mismatch_near(std::data(r1), std::data(r2), std::min(size1, size2), range_value_t<R1>(tolerance));
+  if (__builtin_expect(index == size1 && size1 == size2, 1))
+    return check_passed(site);
+  return check_range_failed(site, r1, r2, index);
 }
 
-template <typename A, typename B>
-bool expect_not_equal(A exp1, B exp2, const char *file, int line, const char *exp1_str, const char *exp2_str,
-                      const std::string *p_ts_name, const std::string *p_tc_name) {
-  bool ok = (exp1 != exp2);
-  std::lock_guard<std::mutex> lock(mtx);
-
-  if (opts.verbose_level > 1 || !ok)
-    std::printf(ok ? "#%lu [\e[32mOK\e[39m] (%s != %s) At %s:%i, in thread #0x%lx\r\n"
-                   : "#%lu [\e[31mFAIL\e[39m] (%s == %s) At %s:%i, in thread "
-                     "#0x%lx\r\n",
-                asserts_counter, exp1_str, exp2_str, file, line,
-                std::hash<std::thread::id>()(std::this_thread::get_id()));
-
-  if (!ok)
-    print_values(exp1, exp2);
+template <typename R1, typename R2>
+bool check_array_ulp(R1 &&r1, R2 &&r2, uint64_t max_ulps, const assert_site_t *site) {
+  check_float_arrays<R1, R2>();
+  size_t size1 = std::size(r1), size2 = std::size(r2);
+  size_t index = mismatch_ulp(std::data(r1), std::data(r2), std::min(size1, size2), max_ulps);
+  if (__builtin_expect(index == size1 && size1 == size2, 1))
+    return check_passed(site);
+  return check_range_failed(site, r1, r2, index);
+}
 
-  test_results.push_back(std::make_tuple(asserts_counter, ok, *p_ts_name, *p_tc_name,
-                                         std::string(file) + ":" + std::to_string(line), std::string(exp1_str),
-                                         std::string(exp2_str)));
-  report.at(*p_ts_name).at(*p_tc_name).push_back(std::make_tuple(ok, "EXPECT_NOT_EQ", exp1_str, exp2_str));
-  asserts_counter++;
-  return ok;
+// Strings are compared as they are, any other contiguous range by the bytes of its elements
+template <typename B> bool check_matches_golden(const B &buffer, const char *path, const assert_site_t *site) {
+  if constexpr (std::is_convertible_v<const B &, std::string_view>) {
+    return check_golden(buffer, path, site);
+  } else {
+    static_assert(is_contiguous_range<const B>::value, "MATCHES_GOLDEN compares strings and contiguous ranges");
+    const char *data = reinterpret_cast<const char *>(std::data(buffer));
+    return check_golden(std::string_view(data, std::size(buffer) * sizeof(range_value_t<const B>)), path, site);
+  }
+}
+
+// TEST_P generators only know their size up front, at(i) makes the value when instance i runs
+template <typename T> class range_generator_t {
+public:
+  range_generator_t(T begin, T end, T step) : begin(begin), step(step) {
+    if constexpr (std::is_floating_point_v<T>)
+      count = end > begin ? size_t(std::ceil((end - begin) / step)) : 0;
+    else
+      count = end > begin ? size_t((end - begin + step - 1) / step) : 0;
+  }
+
+  size_t size() const { return count; }
+  T at(size_t i) const { return T(begin + T(i) * step); }
+
+private:
+  T begin;
+  T step;
+  size_t count;
+};
+
+template <typename T> range_generator_t<T> range(T begin, T end, T step = T(1)) {
+  return range_generator_t<T>(begin, end, step);
 }
+
+template <typename T, typename... Ts> std::vector<T> values(T first, Ts... rest) { return {first, T(rest)...}; }
+
+// Every combination of the values of the generators, the last one varies fastest
+template <typename... Gs> class combine_generator_t {
+public:
+  explicit combine_generator_t(Gs... generators) : generators(std::move(generators)...) {}
+
+  size_t size() const {
+    return std::apply([](const auto &...g) { return (size_t(1) * ... * g.size()); }, generators);
+  }
+
+  auto at(size_t i) const { return at(i, std::index_sequence_for<Gs...>()); }
+
+private:
+  template <size_t... Is> auto at(size_t i, std::index_sequence<Is...>) const {
+    size_t sizes[] = {std::get<Is>(generators).size()...};
+    size_t indexes[sizeof...(Gs)];
+    for (size_t k = sizeof...(Gs); k-- > 0; i /= sizes[k])
+      indexes[k] = i % sizes[k];
+    return std::make_tuple(std::get<Is>(generators).at(indexes[Is])...);
+  }
+
+  std::tuple<Gs...> generators;
+};
+
+template <typename... Gs> combine_generator_t<Gs...> combine(Gs... generators) {
+  return combine_generator_t<Gs...>(std::move(generators)...);
+}
+
+template <typename... Ts> static constexpr size_t type_count_v = sizeof...(Ts);
+
+template <template <typename> class Case, typename... Ts> void run_typed(size_t instance) {
+  static constexpr void (*bodies[])() = {&Case<Ts>::body...};
+  bodies[instance]();
+}
+
+#ifdef TEST_COUNT_ALLOCS
+inline uint64_t case_allocations() { return alloc_counters.allocations; }
+
+inline bool assert_max_allocs(uint64_t allocations, uint64_t max, const assert_site_t *site) {
+  return check_values(site, allocations <= max, allocations, max);
+}
+
+inline bool expect_max_allocs(uint64_t allocations, uint64_t max, const assert_site_t *site) {
+  return check_values(site, allocations <= max, allocations, max);
+}
+#endif
 } // namespace test
 
-#define ASSERT_EQ(A, B, COMMENT)                                                                                       \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::assert_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                         \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res                                                                                                     \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "ASSERT_EQ", std::string(#A), std::string(#B)));                         \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::assert_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                       \
-        std::printf(COMMENT);                                                                                          \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
-
-#define ASSERT_NOT_EQ(A, B, COMMENT)                                                                                   \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::assert_not_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                     \
-        std::printf(COMMENT);                                                                                          \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "ASSERT_NOT_EQ", std::string(#A), std::string(#B)));                     \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::assert_not_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                   \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
-
-#define EXPECT_EQ(A, B, COMMENT)                                                                                       \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::expect_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                         \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "EXPECT_EQ", std::string(#A), std::string(#B)));                         \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::expect_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                       \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
-
-#define EXPECT_NOT_EQ(A, B, COMMENT)                                                                                   \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::expect_not_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                     \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "EXPECT_NOT_EQ", std::string(#A), std::string(#B)));                     \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::expect_not_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                   \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
+// A and B are evaluated exactly once, inside the try, and bound by reference to the check function. COMMENT lives in
+// the static call-site descriptor, so a passing check costs the compare, a branch and, with --fast-pass, a counter
+// bump
+#define TEST_CHECK_IMPL(FUNC, OP, FATAL, A, B, COMMENT)                                                                \
+  ([&]() -> bool {                                                                                                     \
+    static constexpr test::assert_site_t site{__FILE__, __LINE__, test::assert_op_t::OP, FATAL, #A, #B, COMMENT};      \
+    try {                                                                                                              \
+      return test::FUNC(A, B, &site);                                                                                  \
+    } catch (std::exception & e) {                                                                                     \
+      return test::record_exception(&site, e);                                                                         \
     }                                                                                                                  \
-  }(A, B))
-
-#define ASSERT_STREQ(A, B, COMMENT)                                                                                    \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::assert_str_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                     \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "ASSERT_STREQ", std::string(#A), std::string(#B)));                      \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res test::assert_str_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                     \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
+  }())
+
+// Checks with a third operand, passed to FUNC between B and the call site
+#define TEST_CHECK_ARG_IMPL(FUNC, OP, FATAL, A, B, ARG, COMMENT)                                                       \
+  ([&]() -> bool {                                                                                                     \
+    static constexpr test::assert_site_t site{__FILE__, __LINE__, test::assert_op_t::OP, FATAL, #A, #B, COMMENT};      \
+    try {                                                                                                              \
+      return test::FUNC(A, B, ARG, &site);                                                                             \
+    } catch (std::exception & e) {                                                                                     \
+      return test::record_exception(&site, e);                                                                         \
     }                                                                                                                  \
-  }(A, B))
-
-#define ASSERT_NOT_STREQ(A, B, COMMENT)                                                                                \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::assert_not_str_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                 \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "ASSERT_NOT_STREQ", std::string(#A), std::string(#B)));                  \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::assert_not_str_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                               \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        std::terminate();                                                                                              \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
-
-#define EXPECT_STREQ(A, B, COMMENT)                                                                                    \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::expect_str_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                     \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "EXPECT_STREQ", std::string(#A), std::string(#B)));                      \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::expect_str_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                                   \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
-
-#define EXPECT_NOT_STREQ(A, B, COMMENT)                                                                                \
-  (test::stub_res = [&](auto, auto) -> bool {                                                                          \
-    if (test::resolv_ts_tc_names) {                                                                                    \
-      auto [p_ts_name, p_tc_name] = (*test::resolv_ts_tc_names)();                                                     \
-      try {                                                                                                            \
-        bool res = test::expect_not_str_equal(A, B, __FILE__, __LINE__, #A, #B, p_ts_name, p_tc_name);                 \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, *p_ts_name, *p_tc_name,                         \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        report.at(*p_ts_name)                                                                                          \
-            .at(*p_tc_name)                                                                                            \
-            .push_back(std::make_tuple(false, "EXPECT_NOT_STREQ", std::string(#A), std::string(#B)));                  \
-        std::printf(COMMENT);                                                                                          \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    } else {                                                                                                           \
-      try {                                                                                                            \
-        bool res = test::expect_str_not_equal_builtin(A, B, __FILE__, __LINE__, #A, #B);                               \
-        if (!res)                                                                                                      \
-          std::printf(COMMENT "\r\n");                                                                                 \
-        return res;                                                                                                    \
-      } catch (std::exception & e) {                                                                                   \
-        using namespace test;                                                                                          \
-        std::lock_guard<std::mutex> lock(test::mtx);                                                                   \
-        std::printf("#%lu [\e[31mFAIL\e[39m] At %s:%i due to std exception ( "                                         \
-                    "%s ). Terminating ...\r\n",                                                                       \
-                    asserts_counter, __FILE__, __LINE__, e.what());                                                    \
-        asserts_counter++;                                                                                             \
-        test_results.push_back(std::make_tuple(asserts_counter, false, "none", "none",                                 \
-                                               std::string(__FILE__) + ":" + std::to_string(__LINE__),                 \
-                                               std::string(#A), std::string(#B)));                                     \
-        return false;                                                                                                  \
-      }                                                                                                                \
-    }                                                                                                                  \
-  }(A, B))
+  }())
+
+#define ASSERT_EQ(A, B, COMMENT) TEST_CHECK_IMPL(assert_equal, equal, true, A, B, COMMENT)
+#define ASSERT_NOT_EQ(A, B, COMMENT) TEST_CHECK_IMPL(assert_not_equal, not_equal, true, A, B, COMMENT)
+#define EXPECT_EQ(A, B, COMMENT) TEST_CHECK_IMPL(expect_equal, equal, false, A, B, COMMENT)
+#define EXPECT_NOT_EQ(A, B, COMMENT) TEST_CHECK_IMPL(expect_not_equal, not_equal, false, A, B, COMMENT)
+#define ASSERT_STREQ(A, B, COMMENT) TEST_CHECK_IMPL(assert_str_equal, str_equal, true, A, B, COMMENT)
+#define ASSERT_NOT_STREQ(A, B, COMMENT) TEST_CHECK_IMPL(assert_not_str_equal, not_str_equal, true, A, B, COMMENT)
+#define EXPECT_STREQ(A, B, COMMENT) TEST_CHECK_IMPL(expect_str_equal, str_equal, false, A, B, COMMENT)
+#define EXPECT_NOT_STREQ(A, B, COMMENT) TEST_CHECK_IMPL(expect_not_str_equal, not_str_equal, false, A, B, COMMENT)
+
+#define ASSERT_RANGE_EQ(A, B, COMMENT) TEST_CHECK_IMPL(check_range_equal, range_equal, true, A, B, COMMENT)
+#define EXPECT_RANGE_EQ(A, B, COMMENT) TEST_CHECK_IMPL(check_range_equal, range_equal, false, A, B, COMMENT)
+#define ASSERT_BYTES_EQ(A, B, SIZE, COMMENT)                                                                           \
+  TEST_CHECK_ARG_IMPL(check_bytes_equal, bytes_equal, true, A, B, SIZE, COMMENT)
+#define EXPECT_BYTES_EQ(A, B, SIZE, COMMENT)                                                                           \
+  TEST_CHECK_ARG_IMPL(check_bytes_equal, bytes_equal, false, A, B, SIZE, COMMENT)
+#define ASSERT_ARRAY_NEAR(A, B, TOLERANCE, COMMENT)                                                                    \
+  TEST_CHECK_ARG_IMPL(check_array_near, array_near, true, A, B, TOLERANCE, COMMENT)
+#define EXPECT_ARRAY_NEAR(A, B, TOLERANCE, COMMENT)                                                                    \
+  TEST_CHECK_ARG_IMPL(check_array_near, array_near, false, A, B, TOLERANCE, COMMENT)
+#define ASSERT_ARRAY_ULP(A, B, MAX_ULPS, COMMENT)                                                                      \
+  TEST_CHECK_ARG_IMPL(check_array_ulp, array_ulp, true, A, B, MAX_ULPS, COMMENT)
+#define EXPECT_ARRAY_ULP(A, B, MAX_ULPS, COMMENT)                                                                      \
+  TEST_CHECK_ARG_IMPL(check_array_ulp, array_ulp, false, A, B, MAX_ULPS, COMMENT)
+
+#define ASSERT_MATCHES_GOLDEN(BUFFER, PATH, COMMENT)                                                                   \
+  TEST_CHECK_IMPL(check_matches_golden, matches_golden, true, BUFFER, PATH, COMMENT)
+#define EXPECT_MATCHES_GOLDEN(BUFFER, PATH, COMMENT)                                                                   \
+  TEST_CHECK_IMPL(check_matches_golden, matches_golden, false, BUFFER, PATH, COMMENT)
+#ifdef TEST_COUNT_ALLOCS
+#define ASSERT_MAX_ALLOCS(N, COMMENT)                                                                                  \
+  TEST_CHECK_IMPL(assert_max_allocs, max_allocs, true, test::case_allocations(), N, COMMENT)
+#define EXPECT_MAX_ALLOCS(N, COMMENT)                                                                                  \
+  TEST_CHECK_IMPL(expect_max_allocs, max_allocs, false, test::case_allocations(), N, COMMENT)
+#endif
+
+#define TEST_REGISTER_IMPL(TestSuiteName, TestCaseName, FN, INSTANCES)                                                 \
+  static test::testcase_t test_suite_##TestSuiteName##_##test_case_##TestCaseName##_desc{                              \
+      #TestSuiteName, #TestCaseName, __FILE__, __LINE__, FN, 0, INSTANCES, 0};                                         \
+  test::testcase_t *__attribute__((used, section("testcases")))                                                        \
+      test_suite_##TestSuiteName##_##test_case_##TestCaseName##_ptr =                                                  \
+          &test_suite_##TestSuiteName##_##test_case_##TestCaseName##_desc;
 
 #define TEST(TestSuiteName, TestCaseName)                                                                              \
-  volatile void __attribute__((used, weak)) test_suite_##TestSuiteName##_test_case_##TestCaseName##_code();            \
-  volatile void __attribute__((used)) test_suite_##TestSuiteName##_##test_case_##TestCaseName() {                      \
-    static std::string *p_ts_name = &test::ts_name, *p_tc_name = &test::tc_name;                                       \
-    static std::function<std::pair<std::string *, std::string *>(void)> f =                                            \
-        []() -> std::pair<std::string *, std::string *> {                                                              \
-      return {p_ts_name, p_tc_name};                                                                                   \
-    };                                                                                                                 \
-    test::ts_name = #TestSuiteName;                                                                                    \
-    test::tc_name = #TestCaseName;                                                                                     \
-    std::unique_lock<std::mutex> lock(test::mtx);                                                                      \
-    while (!test::notified) {                                                                                          \
-      test::sync_var.wait(lock);                                                                                       \
-    }                                                                                                                  \
-    test::resolv_ts_tc_names = &f;                                                                                     \
-    if (test::report.find(#TestSuiteName) == test::report.end())                                                       \
-      test::report.insert(std::make_pair(                                                                              \
-          #TestSuiteName,                                                                                              \
-          std::map<std::string, std::vector<std::tuple<bool, std::string, std::string, std::string>>>()));             \
-    if (test::report.at(#TestSuiteName).find(#TestCaseName) == test::report.at(#TestSuiteName).end())                  \
-      test::report.at(#TestSuiteName)                                                                                  \
-          .insert(                                                                                                     \
-              std::make_pair(#TestCaseName, std::vector<std::tuple<bool, std::string, std::string, std::string>>()));  \
-    if (opts.verbose_level > 1)                                                                                        \
-      std::printf("\r\nRunning %s : %s ... \r\n\r\n", #TestSuiteName, #TestCaseName);                                  \
-    lock.unlock();                                                                                                     \
-    test::notified = false;                                                                                            \
+  void __attribute__((used, weak)) test_suite_##TestSuiteName##_test_case_##TestCaseName##_code();                     \
+  static void test_suite_##TestSuiteName##_##test_case_##TestCaseName(const test::testcase_t &tc) {                    \
+    test::begin_testcase(tc.id);                                                                                       \
     test_suite_##TestSuiteName##_test_case_##TestCaseName##_code();                                                    \
-    test::notified = true;                                                                                             \
-    test::sync_var.notify_one();                                                                                       \
+    test::end_testcase();                                                                                              \
   }                                                                                                                    \
-                                                                                                                       \
-  volatile const void *__attribute__((used, section("testcases")))                                                     \
-      test_suite_##TestSuiteName##_##test_case_##TestCaseName##_ptr =                                                  \
-          reinterpret_cast<volatile const void *>(test_suite_##TestSuiteName##_##test_case_##TestCaseName);            \
-  volatile void __attribute__((used)) test_suite_##TestSuiteName##_test_case_##TestCaseName##_code()
+  TEST_REGISTER_IMPL(TestSuiteName, TestCaseName, test_suite_##TestSuiteName##_##test_case_##TestCaseName, nullptr)    \
+  void __attribute__((used)) test_suite_##TestSuiteName##_test_case_##TestCaseName##_code()
+
+#define TEST_F(Fixture, TestCaseName)                                                                                  \
+  static void test_suite_##Fixture##_test_case_##TestCaseName##_body([[maybe_unused]] const Fixture &fixture);         \
+  TEST(Fixture, TestCaseName) {                                                                                        \
+    test_suite_##Fixture##_test_case_##TestCaseName##_body(test::fixture_holder_t<Fixture>::get());                    \
+  }                                                                                                                    \
+  static void test_suite_##Fixture##_test_case_##TestCaseName##_body([[maybe_unused]] const Fixture &fixture)
+
+// One testcase per value of GENERATOR, any object with size() and at(i) (test::range, test::values,
+// test::combine, a std::vector ...). The body gets the value as param
+#define TEST_P(TestSuiteName, TestCaseName, GENERATOR)                                                                 \
+  static const auto &test_suite_##TestSuiteName##_test_case_##TestCaseName##_params() {                                \
+    static const auto generator = GENERATOR;                                                                           \
+    return generator;                                                                                                  \
+  }                                                                                                                    \
+  using test_suite_##TestSuiteName##_test_case_##TestCaseName##_param_t =                                              \
+      std::decay_t<decltype(test_suite_##TestSuiteName##_test_case_##TestCaseName##_params().at(0))>;                  \
+  static void test_suite_##TestSuiteName##_test_case_##TestCaseName##_body(                                            \
+      [[maybe_unused]] const test_suite_##TestSuiteName##_test_case_##TestCaseName##_param_t &param);                  \
+  static size_t test_suite_##TestSuiteName##_test_case_##TestCaseName##_instances() {                                  \
+    return test_suite_##TestSuiteName##_test_case_##TestCaseName##_params().size();                                    \
+  }                                                                                                                    \
+  static void test_suite_##TestSuiteName##_##test_case_##TestCaseName(const test::testcase_t &tc) {                    \
+    test::begin_testcase(tc.id);                                                                                       \
+    test_suite_##TestSuiteName##_test_case_##TestCaseName##_body(                                                      \
+        test_suite_##TestSuiteName##_test_case_##TestCaseName##_params().at(tc.instance));                             \
+    test::end_testcase();                                                                                              \
+  }                                                                                                                    \
+  TEST_REGISTER_IMPL(TestSuiteName, TestCaseName, test_suite_##TestSuiteName##_##test_case_##TestCaseName,             \
+                     test_suite_##TestSuiteName##_test_case_##TestCaseName##_instances)                                \
+  static void test_suite_##TestSuiteName##_test_case_##TestCaseName##_body(                                            \
+      [[maybe_unused]] const test_suite_##TestSuiteName##_test_case_##TestCaseName##_param_t &param)
+
+// One testcase per type of the list, the body is a template on TypeParam
+#define TYPED_TEST(TestSuiteName, TestCaseName, ...)                                                                   \
+  template <typename TypeParam> struct test_suite_##TestSuiteName##_test_case_##TestCaseName##_typed {                 \
+    static void body();                                                                                                \
+  };                                                                                                                   \
+  static size_t test_suite_##TestSuiteName##_test_case_##TestCaseName##_instances() {                                  \
+    return test::type_count_v<__VA_ARGS__>;                                                                            \
+  }                                                                                                                    \
+  static void test_suite_##TestSuiteName##_##test_case_##TestCaseName(const test::testcase_t &tc) {                    \
+    test::begin_testcase(tc.id);                                                                                       \
+    test::run_typed<test_suite_##TestSuiteName##_test_case_##TestCaseName##_typed, __VA_ARGS__>(tc.instance);          \
+    test::end_testcase();                                                                                              \
+  }                                                                                                                    \
+  TEST_REGISTER_IMPL(TestSuiteName, TestCaseName, test_suite_##TestSuiteName##_##test_case_##TestCaseName,             \
+                     test_suite_##TestSuiteName##_test_case_##TestCaseName##_instances)                                \
+  template <typename TypeParam> void test_suite_##TestSuiteName##_test_case_##TestCaseName##_typed<TypeParam>::body()
+
+#define BENCHMARK(TestSuiteName, BenchmarkName)                                                                        \
+  void benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName##_code();                                           \
+  static test::benchmark_t benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName{                                \
+      #TestSuiteName, #BenchmarkName, benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName##_code, 0};          \
+  test::benchmark_t *__attribute__((used, section("benchmarks")))                                                      \
+      benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName##_ptr =                                              \
+          &benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName;                                                \
+  void benchmark_suite_##TestSuiteName##_benchmark_##BenchmarkName##_code()
 
 #endif /* TEST_HPP */
@@ -0,0 +1,25 @@
+// Checks made on threads started by a testcase body. Every case below must report one pass and one failure, the
+// one made on its helper thread, in the summary and in the --output reports:
+//   g++ -std=c++17 -O2 -I.. ../test.cpp helper_threads.cpp -pthread -o helper_threads
+//   ./helper_threads --output=json:helper_threads.jsonl && ./helper_threads -j 2
+// FailureOnSoleCase relies on running alone, with -t > 1 only FailureInCaseScope is guaranteed its failure.
+
+#include "test.hpp"
+
+#include <string>
+#include <thread>
+
+TEST(HelperThreads, FailureOnSoleCase) {
+  std::thread helper([] { EXPECT_EQ(1, 2, "Failed on a helper thread"); });
+  helper.join();
+  EXPECT_EQ(1, 1, "Passed on the testcase thread");
+}
+
+TEST(HelperThreads, FailureInCaseScope) {
+  std::thread helper([id = test::running_case()] {
+    test::case_scope_t scope(id);
+    EXPECT_EQ(2 + 2, 4, "Passed on a helper thread");
+    EXPECT_STREQ(std::string("foo"), std::string("bar"), "Failed on a helper thread");
+  });
+  helper.join();
+}